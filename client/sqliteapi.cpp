@@ -6,6 +6,7 @@
 #include <QCoreApplication>
 #include <qwaitcondition.h>
 #include <QMutex>
+#include <QBuffer>
 #include <limits.h>
 
 #include "sqliteapiserverdefs.h"
@@ -13,8 +14,15 @@
 #include "tinysqliteapiclient.h"
 #include "tinysqliteapiclientnotifier.h"
 #include "tinysqliteapi.h"
+#include "tinysqliterowcodec.h"
 #include "logging.h"
 
+// Key counts of the readMany() statements. Keys are padded with NULL to the
+// next size, so only a few statement texts are prepared. The largest stays
+// below the bound parameter limit of SQLite.
+static const int ReadManySizes[] = { 8, 64, 512 };
+static const int ReadManySizeCount = 3;
+
 static QString toSqlVarType(const TinySqlApiInitializer &var)
 {
     QString sqlVar;
@@ -110,6 +118,12 @@ TinySqlApi::TinySqlApi(const QString &table, QObject *parent) : QObject(parent)
 
     DPRINT << "SQLITEAPICLI:Unique client-id:" << clientId;
     columns = 0;
+    responseId = 0;
+    streamPaused = false;
+
+    // Read cache is off until setReadCache() is called
+    cacheGeneration = 0;
+    readCache.setMaxCost(0);
 
     clientNotifier = new TinySqlApiClientNotifier(this, clientId);
     Q_CHECK_PTR(clientNotifier);
@@ -209,7 +223,7 @@ TinySqlApi::~TinySqlApi()
  *    initializers.append(var1);
  *    client->initialize("invitations", identifier, initializers);
  */
-void TinySqlApi::initialize(const TinySqlApiInitializer &identifier, const QList<TinySqlApiInitializer> &initializers)
+int TinySqlApi::initialize(const TinySqlApiInitializer &identifier, const QList<TinySqlApiInitializer> &initializers)
 {
     primaryKey = identifier.name();
 
@@ -239,7 +253,7 @@ void TinySqlApi::initialize(const TinySqlApiInitializer &identifier, const QList
     }
     DPRINT << "columns:" << columns;
     query.append(")");
-    client->sendRequest(CreateTableReq, query, "");
+    return client->sendRequest(CreateTableReq, query, "");
 }
 
 /*!
@@ -248,52 +262,128 @@ void TinySqlApi::initialize(const TinySqlApiInitializer &identifier, const QList
 *
 * \param identifier is the item in the table (id)
 */
-void TinySqlApi::read(const QVariant &identifier)
+int TinySqlApi::read(const QVariant &identifier)
 {
+    QString key = identifier.toString();
+    if( readCache.maxCost() > 0 ) {
+        QList< QList<QVariant> > *items = readCache.object(key);
+        if( items ) {
+            // Responded without the server, signal is emitted asynchronously like for the others
+            int seq = client->nextSeq();
+            if( cacheHits.isEmpty() ) {
+                QMetaObject::invokeMethod(this, "emitCachedReads", Qt::QueuedConnection);
+            }
+            cacheHits.insert(seq, *items);
+            return seq;
+        }
+        // Subscribed before the read, a change after the read is then notified
+        subscribeCached(key);
+    }
+
     QString query;
-    query.append(QString("SELECT * FROM %1 WHERE %2 = '%3'").arg(tableName).arg(primaryKey).arg(identifier.toString()) );
+    query.append(QString("SELECT * FROM %1 WHERE %2 = ?").arg(tableName).arg(primaryKey) );
     
-    client->sendRequest(ReadGenItemReq, query, "");
+    int seq = client->sendRequest(ReadGenItemReq, query, "", QVariantList() << identifier);
+    if( readCache.maxCost() > 0 ) {
+        cachedReads.insert(seq, qMakePair(key, cacheGeneration));
+    }
+    return seq;
+}
+
+/*!
+ * Request several items with their identifiers (primary keys) at once.
+ * Items are read with one statement per up to 512 identifiers, and all
+ * of them are emitted together when every statement is responded.
+ * Asynchronous method, emits tinySqlApiReadMany signal.
+ *
+ * \param identifiers Identifiers of the items
+ * \return Request id, 0 if there are no identifiers
+ */
+int TinySqlApi::readMany(const QList<QVariant> &identifiers)
+{
+    if( identifiers.isEmpty() ) {
+        return 0;
+    }
+
+    int id = 0;
+    ManyRead read;
+    read.identifiers = identifiers;
+    read.statements = 0;
+    read.status = NoError;
+
+    const int maxKeys = ReadManySizes[ReadManySizeCount - 1];
+    for( int first=0; first<identifiers.count(); first+=maxKeys ) {
+        QVariantList params = identifiers.mid(first, maxKeys);
+        int size = maxKeys;
+        for( int i=0; i<ReadManySizeCount; i++ ) {
+            if( ReadManySizes[i] >= params.count() ) {
+                size = ReadManySizes[i];
+                break;
+            }
+        }
+        // NULL matches no key
+        while( params.count() < size ) {
+            params.append(QVariant());
+        }
+
+        QStringList placeholders;
+        for( int i=0; i<size; i++ ) {
+            placeholders.append("?");
+        }
+        QString query;
+        query.append( QString("SELECT * FROM %1 WHERE %2 IN (%3)").arg(tableName).arg(primaryKey)
+                      .arg(placeholders.join(",")) );
+        int seq = client->sendRequest(ReadAllGenItemsReq, query, "", params);
+
+        // Whole read is identified by its first statement
+        if( id == 0 ) {
+            id = seq;
+        }
+        manyStatements.insert(seq, id);
+        read.statements++;
+    }
+    manyReads.insert(id, read);
+    return id;
 }
 
 /*!
  * Request total count of rows.
  * Asynchronous method, emits tinySqlApiCount signal.
  */
-void TinySqlApi::count()
+int TinySqlApi::count()
 {
     QString query;
     query.append(QString("SELECT COUNT(*) AS NumberOfOrders FROM %1").arg(tableName));
-    client->sendRequest(CountReq, query, "");
+    return client->sendRequest(CountReq, query, "");
 }
 
 /*!
  * Request list of all tables from DB.
  * Asynchronous method, emits tinySqlApiTablesRes signal.
  */
-void TinySqlApi::readTables()
+int TinySqlApi::readTables()
 {
     QString query;
     query.append(QString("SELECT name FROM sqlite_master WHERE type='table'"));
-    client->sendRequest(ReadTablesReq, query, "");
+    return client->sendRequest(ReadTablesReq, query, "");
 }
 
 /*!
  * Request all columns (schema) for a current table.
  * Asynchronous method, emits tinySqlApiColumnsRes signal.
  */
-void TinySqlApi::readColumns()
+int TinySqlApi::readColumns()
 {
     QString query;
     query.append( QString("PRAGMA table_info(%1)").arg(tableName) );
-    client->sendRequest(ReadColumnsReq, query, "");
+    return client->sendRequest(ReadColumnsReq, query, "");
 }
 
 /*!
  * Request all items from table. Emits  
  * TinySqlApiRead signal with the items or errorcode.
  */       
-void TinySqlApi::readAll(int columnsCount)
+int TinySqlApi::readAll(int columnsCount)
 {
     DPRINT << "readAll";
     if( columnsCount >= 0) {
@@ -302,7 +392,199 @@ void TinySqlApi::readAll(int columnsCount)
     }
     QString query;
     query.append( QString("SELECT * FROM %1").arg(tableName) );
-    client->sendRequest(ReadAllGenItemsReq, query, "");
+    return client->sendRequest(ReadAllGenItemsReq, query, "");
+}
+
+/*!
+ * Request one page of items in primary key order, starting from the
+ * offset. Asynchronous method, emits tinySqlApiReadPage signal.
+ * Server skips the rows before the offset, prefer readAfter() for
+ * the pages far from the start of a large table.
+ *
+ * \param offset Count of items before the page
+ * \param limit Count of items in the page, at least 1
+ */
+int TinySqlApi::readRange(int offset, int limit)
+{
+    limit = qMax(1, limit);
+    offset = qMax(0, offset);
+    // One row more tells if there is a next page
+    QString query;
+    query.append( QString("SELECT * FROM %1 ORDER BY %2 LIMIT ? OFFSET ?").arg(tableName).arg(primaryKey) );
+    int seq = client->sendRequest(ReadAllGenItemsReq, query, "", QVariantList() << limit + 1 << offset);
+    pageRequests.insert(seq, qMakePair(limit, offset));
+    return seq;
+}
+
+/*!
+ * Request the page of items following the item lastKey in primary key
+ * order. The page is found with the primary key index, the earlier rows
+ * are not read. Asynchronous method, emits tinySqlApiReadPage signal.
+ *
+ * \param lastKey Primary key of the last item of the previous page,
+ *                or continuation of its tinySqlApiReadPage signal.
+ *                Invalid QVariant for the first page.
+ * \param limit Count of items in the page, at least 1
+ */
+int TinySqlApi::readAfter(const QVariant &lastKey, int limit)
+{
+    limit = qMax(1, limit);
+    QString query;
+    QVariantList params;
+    if( lastKey.isValid() ) {
+        query.append( QString("SELECT * FROM %1 WHERE %2 > ? ORDER BY %2 LIMIT ?").arg(tableName).arg(primaryKey) );
+        params << lastKey;
+    }
+    else {
+        query.append( QString("SELECT * FROM %1 ORDER BY %2 LIMIT ?").arg(tableName).arg(primaryKey) );
+    }
+    params << limit + 1;
+    int seq = client->sendRequest(ReadAllGenItemsReq, query, "", params);
+    pageRequests.insert(seq, qMakePair(limit, -1));
+    return seq;
+}
+
+/*!
+ * Request the columns of the items matching the query. Only the matching
+ * items and the selected columns are read and sent by the server.
+ * Asynchronous method, emits tinySqlApiRead signal.
+ *
+ * \param query Columns, conditions, order and count of the items
+ * \return Request id, 0 if the query has invalid column names
+ */
+int TinySqlApi::query(const TinySqlApiQuery &query)
+{
+    if( !query.isValid() ) {
+        DPRINT << "SQLITEAPICLI:ERR, invalid column name in the query";
+        return 0;
+    }
+    return client->sendRequest(ReadAllGenItemsReq, query.statement(tableName), "", query.params());
+}
+
+/*!
+ * Creates an index of the current table, reads with conditions or order
+ * on the indexed columns then seek the index instead of scanning the table.
+ * Asynchronous method, emits tinySqlApiIndex signal.
+ *
+ * \param name Name of the index, unique in the database
+ * \param columns Indexed columns, several for a composite index
+ * \param unique True if two items can not have the same values in the columns
+ * \param condition SQL expression of a partial index, only the items
+ *                  matching it are indexed. Empty to index all the items.
+ * \return Request id, 0 if a name is invalid
+ */
+int TinySqlApi::createIndex(const QString &name, const QStringList &columns, bool unique, const QString &condition)
+{
+    bool valid = TinySqlApiQuery::isIdentifier(name) && !columns.isEmpty();
+    foreach (const QString &column, columns) {
+        valid = valid && TinySqlApiQuery::isIdentifier(column);
+    }
+    if( !valid ) {
+        DPRINT << "SQLITEAPICLI:ERR, invalid index or column name";
+        return 0;
+    }
+
+    QString query;
+    query.append( QString("CREATE %1INDEX %2 ON %3 (%4)").arg(unique ? "UNIQUE " : "")
+                  .arg(name).arg(tableName).arg(columns.join(", ")) );
+    if( !condition.isEmpty() ) {
+        query.append( QString(" WHERE %1").arg(condition) );
+    }
+    return client->sendRequest(CreateIndexReq, query, "");
+}
+
+/*!
+ * Drops the index created by createIndex(). Dropping an index that does
+ * not exist is not an error. Asynchronous method, emits tinySqlApiIndex signal.
+ *
+ * \param name Name of the index
+ * \return Request id, 0 if the name is invalid
+ */
+int TinySqlApi::dropIndex(const QString &name)
+{
+    if( !TinySqlApiQuery::isIdentifier(name) ) {
+        DPRINT << "SQLITEAPICLI:ERR, invalid index name";
+        return 0;
+    }
+    QString query;
+    query.append( QString("DROP INDEX IF EXISTS %1").arg(name) );
+    return client->sendRequest(DropIndexReq, query, "");
+}
+
+/*!
+ * Request the indexes of the current table.
+ * Asynchronous method, emits tinySqlApiIndexesRes signal.
+ */
+int TinySqlApi::listIndexes()
+{
+    QString query;
+    query.append( "SELECT name, sql FROM sqlite_master WHERE type='index' AND tbl_name = ?" );
+    return client->sendRequest(ReadIndexesReq, query, "", QVariantList() << tableName);
+}
+
+/*!
+ * Request the read statements of the database followed by the server's
+ * index advisor. Recurring statements are explained, and an index is
+ * suggested for the ones that scan the whole table or sort the rows.
+ * The last row, with an empty statement, tells the hits and misses of
+ * the server's row cache.
+ * Asynchronous method, emits tinySqlApiStats signal.
+ */
+int TinySqlApi::readStats()
+{
+    return client->sendRequest(StatsReq, "", "");
+}
+
+/*!
+ * Request all items from table in chunks. Rows are not collected to one
+ * list, tinySqlApiReadChunk signal is emitted for every batch received
+ * from the server, the last one with the last flag set. Client memory
+ * stays bounded by the batch size and the flow control window.
+ * Use pauseStream() to stop receiving until resumeStream() is called.
+ */
+int TinySqlApi::streamAll(int columnsCount)
+{
+    DPRINT << "streamAll";
+    if( columnsCount >= 0) {
+        columns = columnsCount;
+    }
+    QString query;
+    query.append( QString("SELECT * FROM %1").arg(tableName) );
+    int seq = client->sendRequest(ReadAllGenItemsReq, query, "");
+    streamedRequests.insert(seq);
+    return seq;
+}
+
+/*!
+ * Stops delivering the chunks of streamAll(), can be called from the slot
+ * handling tinySqlApiReadChunk. Received chunks are held back and the server
+ * stops reading rows when its share of the flow control window is used.
+ * Other responses of this object are delivered as usual.
+ */
+void TinySqlApi::pauseStream()
+{
+    streamPaused = true;
+}
+
+/*!
+ * Continues delivering the chunks paused with pauseStream().
+ * Held back chunks are emitted from the event loop.
+ */
+void TinySqlApi::resumeStream()
+{
+    if( !streamPaused ) {
+        return;
+    }
+    streamPaused = false;
+    QMetaObject::invokeMethod(this, "emitHeldChunks", Qt::QueuedConnection);
+}
+
+/*!
+ * Tells if the stream is paused with pauseStream().
+ */
+bool TinySqlApi::isStreamPaused() const
+{
+    return streamPaused;
 }
 
 /*!
@@ -311,9 +593,12 @@ void TinySqlApi::readAll(int columnsCount)
  *
  * \param identifier of the item in the list (based to primary key)
  */
-void TinySqlApi::subscribeChangeNotifications(const QVariant &identifier)
+int TinySqlApi::subscribeChangeNotifications(const QVariant &identifier)
 {
-    client->sendRequest(SubscribeNotificationsReq, "", identifier);
+    // Kept also if the cache drops the key
+    cacheSubscriptions.remove(identifier.toString());
+    subscriptions.insert(identifier.toString());
+    return client->sendRequest(SubscribeNotificationsReq, tableName, identifier);
 }
 
 /*!
@@ -321,9 +606,12 @@ void TinySqlApi::subscribeChangeNotifications(const QVariant &identifier)
  *
  * \param identifier of the item in the list (based to primary key)
  */
-void TinySqlApi::unsubscribeChangeNotifications(const QVariant &identifier)
+int TinySqlApi::unsubscribeChangeNotifications(const QVariant &identifier)
 {
-    client->sendRequest(UnsubscribeNotificationsReq, "", identifier);
+    // Changes of the item are not notified anymore, cached rows could get old
+    subscriptions.remove(identifier.toString());
+    invalidateCached(identifier.toString());
+    return client->sendRequest(UnsubscribeNotificationsReq, tableName, identifier);
 }
 
 /*!
@@ -334,31 +622,121 @@ void TinySqlApi::unsubscribeChangeNotifications(const QVariant &identifier)
  *
  * \param item contains the values for new item.
  */ 
-void TinySqlApi::writeItem(QVariant &item)
+int TinySqlApi::writeItem(QVariant &item)
 {
     QString query;
     query.append( QString("INSERT INTO %1 VALUES (").arg(tableName) );
 
+    // Values are bound, statement is the same for every item of the table
     int i = 0;
     QList<QVariant> itemList = item.toList();
     foreach (QVariant value, itemList) {
-        query.append( QString("'%1'").arg(value.toString()) );
+        query.append("?");
         i++;
         if(i<itemList.count()) {
             query.append(",");
         }
     }
     query.append(")");
-    client->sendRequest(WriteGenItemReq, query, itemList[0].toString());
+    // Server does not notify the client of its own changes
+    invalidateCached(itemList[0].toString());
+    return client->sendRequest(WriteGenItemReq, query, itemList[0].toString(), itemList);
+}
+
+/*!
+ * Writes several items with one request. All the items are inserted in one
+ * transaction with the same statement. Asynchronous method, emits
+ * TinySqlApiWriteItems signal.
+ * Items that could not be written are skipped, the others are still written.
+ *
+ * \param items contains the values for each new item, all with the same structure.
+ */
+int TinySqlApi::writeItems(const QList<QVariant> &items)
+{
+    if( items.isEmpty() ) {
+        return 0;
+    }
+
+    QString query;
+    query.append( QString("INSERT INTO %1 VALUES (").arg(tableName) );
+
+    // Statement is built for the first item, every item is bound to it in turn
+    int columns = items.first().toList().count();
+    for( int i=0; i<columns; i++ ) {
+        query.append("?");
+        if(i+1<columns) {
+            query.append(",");
+        }
+    }
+    query.append(")");
+    foreach (const QVariant &item, items) {
+        invalidateCached(item.toList().value(0).toString());
+    }
+    return client->sendRequest(WriteGenItemsReq, query, QVariant(), items);
+}
+
+/*!
+ * Starts a transaction. Writes and deletes of this client are then
+ * committed together by commitTransaction() or discarded by rollbackTransaction().
+ * Requests of the other clients that write wait until the transaction ends,
+ * their reads see the data before the transaction.
+ * Server rolls the transaction back if the client is idle for too long.
+ * Asynchronous method, emits TinySqlApiTransaction signal.
+ */
+int TinySqlApi::beginTransaction()
+{
+    return client->sendRequest(BeginTransactionReq, "BEGIN IMMEDIATE", QVariant());
+}
+
+/*!
+ * Commits the transaction started by beginTransaction().
+ * Change notifications of its writes are sent to the other clients now.
+ * Asynchronous method, emits TinySqlApiTransaction signal.
+ */
+int TinySqlApi::commitTransaction()
+{
+    return client->sendRequest(CommitReq, "COMMIT", QVariant());
+}
+
+/*!
+ * Discards the writes of the transaction started by beginTransaction().
+ * Asynchronous method, emits TinySqlApiTransaction signal.
+ */
+int TinySqlApi::rollbackTransaction()
+{
+    // Rows read inside the transaction may be discarded
+    invalidateCached(QString());
+    return client->sendRequest(RollbackReq, "ROLLBACK", QVariant());
 }
 
 /*!
- * Cancels last async operation going on
- * (removes the request from server queue if it still  exists). 
+ * Cancels last async operation going on.
+ * If the request is not yet sent or is still in the server queue it is
+ * removed and TinySqlApiCancel signal is emitted for it. If it is being
+ * executed a read is interrupted, a write runs to completion. If its rows
+ * are being sent the rest of the rows are dropped. The request is then
+ * responded with CancelledError. The cancel is sent to the server ahead of
+ * the requests waiting for the pipeline. Statements are interrupted only if
+ * the server's SQLite driver uses the SQLite library the server is linked to.
+ * Transaction begin, commit and rollback are not cancelled.
+ *
+ * \return Sequence number of the cancelled request, 0 if there is none
  */
-void TinySqlApi::cancelAsyncRequest()
+int TinySqlApi::cancelAsyncRequest()
 {
-    client->sendRequest(CancelLastReq);
+    // Request not sent yet is completed here, signal is emitted asynchronously like for the others
+    int seq = client->takeLastQueued();
+    if( seq > 0 ) {
+        QMetaObject::invokeMethod(this, "emitCancelled", Qt::QueuedConnection, Q_ARG(int, seq));
+        return seq;
+    }
+
+    // Server finds the request by its sequence number
+    seq = client->lastPendingSeq();
+    if( seq > 0 && client->sendCancel(seq) > 0 ) {
+        return seq;
+    }
+    return 0;
 }
 
 /*!
@@ -367,11 +745,12 @@ void TinySqlApi::cancelAsyncRequest()
  *
  * \param identifier of the item in the list
  */
-void TinySqlApi::deleteItem(const QVariant &identifier)
+int TinySqlApi::deleteItem(const QVariant &identifier)
 {
     QString query;
-    query.append( QString("DELETE FROM %1 WHERE %2 = '%3'").arg(tableName).arg(primaryKey).arg(identifier.toString()) );
-    client->sendRequest(DeleteReq, query, identifier);
+    query.append( QString("DELETE FROM %1 WHERE %2 = ?").arg(tableName).arg(primaryKey) );
+    invalidateCached(identifier.toString());
+    return client->sendRequest(DeleteReq, query, identifier, QVariantList() << identifier);
 }
 
 /*!
@@ -379,7 +758,7 @@ void TinySqlApi::deleteItem(const QVariant &identifier)
  * Asynchronous method, emits tinySqlApiDeleteAll signal.
  *
  */
-void TinySqlApi::deleteAll(const QString &name)
+int TinySqlApi::deleteAll(const QString &name)
 {
     QString query;
     if (name == "") {
@@ -388,7 +767,8 @@ void TinySqlApi::deleteAll(const QString &name)
     else {
         query.append( QString("DROP TABLE %1").arg(name) );
     }
-    client->sendRequest(DeleteAllReq, query, "");
+    invalidateCached(QString());
+    return client->sendRequest(DeleteAllReq, query, "");
 }
 
 /*!
@@ -397,6 +777,7 @@ void TinySqlApi::deleteAll(const QString &name)
 void TinySqlApi::setTable(const QString &name)
 {
     tableName = name;
+    invalidateCached(QString());
 }
 
 /*!
@@ -405,104 +786,442 @@ void TinySqlApi::setTable(const QString &name)
 void TinySqlApi::setPrimaryKey(const QString &key)
 {
     primaryKey = key;
+    invalidateCached(QString());
+}
+
+/*!
+ * Changes the database of this client. The following requests go to the
+ * new database, server opens it if it is not open yet. Databases stay open
+ * side by side, other clients and their requests are not affected.
+ * If the database can not be opened, tinySqlApiServiceInitialized is emitted
+ * with DatabaseError and the requests to it are responded with the same error.
+ *
+ * \param fileName Database file, empty for the default database
+ */
+int TinySqlApi::changeDB(const QString &fileName)
+{
+    client->setDatabase(fileName);
+    invalidateCached(QString());
+    return client->sendRequest(ChangeDBReq, "", fileName);
 }
 
 /*!
- * Changes the current database.
+ * Sets how many requests can be sent to the server before the responses
+ * to the earlier ones have been received. Further requests are queued.
+ * Responses are matched to the requests with responseRequestId().
+ *
+ * \param depth Count of outstanding requests, at least 1
  */
-void TinySqlApi::changeDB(const QString &fileName)
+void TinySqlApi::setPipelineDepth(int depth)
 {
-    client->sendRequest(ChangeDBReq, "", fileName);
+    client->setPipelineDepth(depth);
 }
 
-void TinySqlApi::handleItemDataRes(QDataStream &stream)
+/*!
+ * Sets the deadline of the requests made after this call. Request not
+ * executed by the deadline is skipped, and a read still running at the
+ * deadline is interrupted. Result whose rows are still being sent at the
+ * deadline is ended after the current batch. All are responded with
+ * TimeoutError. Writes already running are completed. Running statements
+ * are interrupted only if the server's SQLite driver uses the SQLite
+ * library the server is linked to, the server warns at startup otherwise.
+ *
+ * \param msecs Time from the request call to the deadline, 0 for no deadline
+ */
+void TinySqlApi::setRequestTimeout(int msecs)
+{
+    client->setRequestTimeout(msecs);
+}
+
+/*!
+ * Enables the read cache. Rows returned by read() are kept by the primary
+ * key, and a later read() of the same item is responded from the cache
+ * without the server. The cached items are subscribed for change
+ * notifications, an item changed or deleted by another client is dropped
+ * from the cache. Writes and deletes of this client drop the item too.
+ * Least recently read items are dropped when the cache is full.
+ * The cache is cleared when the table, primary key or database is changed.
+ *
+ * \param items Count of items kept, 0 disables the cache (default)
+ */
+void TinySqlApi::setReadCache(int items)
+{
+    readCache.setMaxCost(qMax(0, items));
+    if( items > 0 ) {
+        return;
+    }
+    invalidateCached(QString());
+    foreach (const QString &key, cacheSubscriptions) {
+        client->sendRequest(UnsubscribeNotificationsReq, "", key);
+    }
+    cacheSubscriptions.clear();
+}
+
+/*
+ * Subscribes the change notifications of the item to be cached, unless
+ * already subscribed. Subscriptions of items dropped from the cache are
+ * removed when they outnumber the cache size.
+ */
+void TinySqlApi::subscribeCached(const QString &key)
+{
+    if( subscriptions.contains(key) || cacheSubscriptions.contains(key) ) {
+        return;
+    }
+    if( cacheSubscriptions.count() >= 2 * readCache.maxCost() ) {
+        foreach (const QString &subscribed, cacheSubscriptions.values()) {
+            if( !readCache.contains(subscribed) ) {
+                client->sendRequest(UnsubscribeNotificationsReq, tableName, subscribed);
+                cacheSubscriptions.remove(subscribed);
+            }
+        }
+    }
+    cacheSubscriptions.insert(key);
+    client->sendRequest(SubscribeNotificationsReq, tableName, key);
+}
+
+/*
+ * Drops the item from the read cache, empty key drops all the items.
+ * Reads already sent are not cached when they are responded.
+ */
+void TinySqlApi::invalidateCached(const QString &key)
+{
+    cacheGeneration++;
+    if( key.isEmpty() ) {
+        readCache.clear();
+    }
+    else {
+        readCache.remove(key);
+    }
+}
+
+/*
+ * Collects the rows of a readMany() statement, the signal is emitted when
+ * all of its statements are responded. Identifiers are matched to the
+ * primary key, the first column of the items.
+ */
+void TinySqlApi::readManyResponded(int seq, int status, const QList< QList<QVariant> > &items)
+{
+    int id = manyStatements.take(seq);
+    QHash<int, ManyRead>::iterator read = manyReads.find(id);
+    if( read == manyReads.end() ) {
+        return;
+    }
+    read->items << items;
+    if( status != NoError && read->status == NoError ) {
+        read->status = status;
+    }
+    if( --read->statements > 0 ) {
+        return;
+    }
+
+    ManyRead done = read.value();
+    manyReads.erase(read);
+
+    QSet<QString> found;
+    foreach (const QList<QVariant> &item, done.items) {
+        found.insert(item.value(0).toString());
+    }
+    QList<QVariant> missing;
+    foreach (const QVariant &identifier, done.identifiers) {
+        if( !found.contains(identifier.toString()) ) {
+            missing.append(identifier);
+        }
+    }
+    DPRINT << "SQLITEAPICLI:readMany:" << done.items.count() << "found," << missing.count() << "missing";
+
+    responseId = id;
+    emit tinySqlApiReadMany( (TinySqlApiServerError)done.status, done.items, missing );
+}
+
+/*
+ * Drops the state of the cancelled request and completes it with the error.
+ */
+void TinySqlApi::requestCancelled(int seq, int status)
+{
+    pendingRows.remove(seq);
+    pendingSchemas.remove(seq);
+    streamedRequests.remove(seq);
+    cachedReads.remove(seq);
+    pageRequests.remove(seq);
+    for( int i=heldChunks.count()-1; i>=0; i-- ) {
+        QDataStream held(heldChunks.at(i));
+        held.setVersion(int(QDataStream::Qt_4_0));
+        int response;
+        int heldSeq;
+        held >> response;
+        held >> heldSeq;
+        if( heldSeq == seq ) {
+            clientNotifier->releaseFrame(heldChunks.takeAt(i).size());
+        }
+    }
+    if( manyStatements.contains(seq) ) {
+        // Part of the multi-key read, completed with the error
+        readManyResponded( seq, status, QList< QList<QVariant> >() );
+        return;
+    }
+    emit tinySqlApiCancel( (TinySqlApiServerError)status );
+}
+
+void TinySqlApi::emitCancelled(int seq)
+{
+    DPRINT << "SQLITEAPICLI:cancelled before sent:" << seq;
+    responseId = seq;
+    requestCancelled( seq, CancelledError );
+    responseId = 0;
+}
+
+/*
+ * Emits the chunks held while the stream was paused, in the order received.
+ * Each chunk is credited to the server only after it is handled.
+ */
+void TinySqlApi::emitHeldChunks()
+{
+    while( !streamPaused && !heldChunks.isEmpty() ) {
+        QByteArray chunk = heldChunks.takeFirst();
+        QDataStream stream(chunk);
+        stream.setVersion(int(QDataStream::Qt_4_0));
+        int response;
+        int seq;
+        stream >> response;
+        stream >> seq;
+
+        // Chunks of a cancelled stream are dropped
+        bool complete = false;
+        if( streamedRequests.contains(seq) ) {
+            responseId = seq;
+            complete = handleItemDataRes( stream, seq );
+            responseId = 0;
+        }
+        clientNotifier->releaseFrame(chunk.size());
+        if( complete ) {
+            client->serverResponseReceived(seq);
+        }
+    }
+}
+
+void TinySqlApi::emitCachedReads()
+{
+    QMap<int, QList< QList<QVariant> > > hits = cacheHits;
+    cacheHits.clear();
+
+    QMap<int, QList< QList<QVariant> > >::const_iterator i;
+    for( i = hits.constBegin(); i != hits.constEnd(); ++i ) {
+        DPRINT << "SQLITEAPICLI:read cache hit:" << i.key();
+        responseId = i.key();
+        emit tinySqlApiRead( NoError, i.value() );
+    }
+    responseId = 0;
+}
+
+/*
+ * Decodes one batch frame of rows in TinySqlApiRowCodec format. Rows of a
+ * multi-frame result are collected to pendingRows until the last frame.
+ * Returns true when the result is complete.
+ */
+bool TinySqlApi::decodeRows(QDataStream &stream, int seq, int &status)
 {
-    int status;
     stream >> status;
     DPRINT << "SQLITEAPICLI:Status_text:" << status;
-    DPRINT << "SQLITEAPICLI:columns:" << columns;
 
-    QList< QList<QVariant> > itemList;
-    QList<QVariant> item;
+    bool last;
+    int rows;
+    QByteArray schema;
+    stream >> last;
+    stream >> rows;
+    stream >> schema;
+    DPRINT << "SQLITEAPICLI:rows:" << rows << "last:" << last;
+
+    // Column types are sent only in the first frame of the result
+    if( schema.isEmpty() ) {
+        schema = pendingSchemas.value(seq);
+    }
+    else if( !last ) {
+        pendingSchemas.insert(seq, schema);
+    }
+
+    QList< QList<QVariant> > &itemList = pendingRows[seq];
+    itemList.reserve(itemList.count() + rows);
+
+    // Rows follow the header, they are decoded directly from the frame data
+    QBuffer *buffer = qobject_cast<QBuffer *>(stream.device());
+    bool valid = (stream.status() == QDataStream::Ok) && buffer;
+    if( valid ) {
+        const QByteArray &data = buffer->data();
+        int pos = int(buffer->pos());
+        for( int row=0; row<rows && valid; row++ ) {
+            QList<QVariant> item;
+            item.reserve(schema.size());
+            valid = TinySqlApiRowCodec::readRow(data.constData(), data.size(), pos, schema, item);
+            itemList << item;
+        }
+        buffer->seek(pos);
+    }
+
+    if( !valid ) {
+        DPRINT << "SQLITEAPICLI:ERR, corrupted batch frame";
+        status = UndefinedError;
+        last = true;
+    }
+    if( last ) {
+        pendingSchemas.remove(seq);
+    }
+    return last;
+}
+
+bool TinySqlApi::handleItemDataRes(QDataStream &stream, int seq)
+{
+    int status;
+    bool last = decodeRows(stream, seq, status);
+
+    if( streamedRequests.contains(seq) ) {
+        // Streamed result, rows of this frame only
+        QList< QList<QVariant> > chunk = pendingRows.take(seq);
+        if( last ) {
+            streamedRequests.remove(seq);
+        }
+        emit tinySqlApiReadChunk( (TinySqlApiServerError)status, chunk, last );
+        return last;
+    }
+    if( !last ) {
+        return false;
+    }
 
-    int count=0;
-    while (!stream.atEnd()) {
-        DPRINT << "SQLITEAPICLI:new row";
-        while (count++<columns && !stream.atEnd()) {
-            DPRINT << "reading item " << count;
-            item << stream;
+    QList< QList<QVariant> > items = pendingRows.take(seq);
+    if( manyStatements.contains(seq) ) {
+        readManyResponded( seq, status, items );
+        return true;
+    }
+    if( pageRequests.contains(seq) ) {
+        // Extra row was read only to know if there is a next page.
+        // The next page continues after the primary key (first column) or offset of the last item.
+        QPair<int, int> page = pageRequests.take(seq);
+        QVariant next;
+        if( items.count() > page.first ) {
+            while( items.count() > page.first ) {
+                items.removeLast();
+            }
+            next = (page.second < 0) ? items.last().value(0) : QVariant(page.second + page.first);
         }
+        emit tinySqlApiReadPage( (TinySqlApiServerError)status, items, next );
+        return true;
+    }
+    DPRINT << "SQLITEAPICLI:rows:" << items.count();
 #ifdef QT_DEBUG
+    foreach (QList<QVariant> item, items) {
         foreach (QVariant rowValue, item) {
             DPRINT << "SQLITEAPICLI:new gen item:" << rowValue.toString();
         }
-#endif
-        itemList << item;
-        item.clear();
-        count = 0;
     }
-    DPRINT << "SQLITEAPICLI:rows:" << itemList.count();
-    if (itemList.count()==0) {
+#endif
+    if (items.count()==0 && status==NoError) {
         status = NotFoundError;
     }
-    emit tinySqlApiRead( (TinySqlApiServerError)status, itemList );
+    // Cached unless the item was changed after the read was sent
+    if( cachedReads.contains(seq) ) {
+        QPair<QString, quint64> read = cachedReads.take(seq);
+        if( status == NoError && read.second == cacheGeneration ) {
+            readCache.insert(read.first, new QList< QList<QVariant> >(items));
+        }
+    }
+    emit tinySqlApiRead( (TinySqlApiServerError)status, items );
+    return true;
 }
 
-void TinySqlApi::handleTablesDataRes(QDataStream &stream)
+bool TinySqlApi::handleTablesDataRes(QDataStream &stream, int seq)
 {
     int status;
-    stream >> status;
-    DPRINT << "SQLITEAPICLI:Status_text:" << status;
+    if( !decodeRows(stream, seq, status) ) {
+        return false;
+    }
 
     QList<QVariant> tables;
-
-    while (!stream.atEnd()) {
-        tables << stream;
+    foreach (QList<QVariant> row, pendingRows.take(seq)) {
+        tables << row;
     }
 
     if (tables.count()==0) {
         status = NotFoundError;
     }
     emit tinySqlApiTablesRes( (TinySqlApiServerError)status, tables );
+    return true;
 }
 
-void TinySqlApi::handleColumnsDataRes(QDataStream &stream)
+bool TinySqlApi::handleIndexesDataRes(QDataStream &stream, int seq)
 {
     int status;
-    stream >> status;
-    DPRINT << "SQLITEAPICLI:Status_text:" << status;
+    if( !decodeRows(stream, seq, status) ) {
+        return false;
+    }
 
-    QList<QVariant> columns;
+    QList< QList<QVariant> > indexes = pendingRows.take(seq);
+    DPRINT << "SQLITEAPICLI:indexes:" << indexes.count();
+    emit tinySqlApiIndexesRes( (TinySqlApiServerError)status, indexes );
+    return true;
+}
+
+bool TinySqlApi::handleStatsRes(QDataStream &stream, int seq)
+{
+    int status;
+    if( !decodeRows(stream, seq, status) ) {
+        return false;
+    }
 
-    while (!stream.atEnd()) {
-        columns << stream;
+    QList< QList<QVariant> > statements = pendingRows.take(seq);
+    DPRINT << "SQLITEAPICLI:statements:" << statements.count();
+    emit tinySqlApiStats( (TinySqlApiServerError)status, statements );
+    return true;
+}
+
+bool TinySqlApi::handleColumnsDataRes(QDataStream &stream, int seq)
+{
+    int status;
+    if( !decodeRows(stream, seq, status) ) {
+        return false;
+    }
+
+    // All the table_info values in one list, as before
+    QList<QVariant> columns;
+    foreach (QList<QVariant> row, pendingRows.take(seq)) {
+        columns << row;
     }
 
     if (columns.count()==0) {
         status = NotFoundError;
     }
     emit tinySqlApiColumnsRes( (TinySqlApiServerError)status, columns );
+    return true;
 }
 
-void TinySqlApi::handleCountRes(QDataStream &stream)
+bool TinySqlApi::handleCountRes(QDataStream &stream, int seq)
 {
     int status;
-    stream >> status;
-    DPRINT << "SQLITEAPICLI:Status:" << status;
+    if( !decodeRows(stream, seq, status) ) {
+        return false;
+    }
 
-    int type = -1;  // Type var is found as first for QVariant
-    stream >> type;
-    int count;
-    stream >> count;
+    QList< QList<QVariant> > rows = pendingRows.take(seq);
+    int count = 0;
+    if( rows.count() > 0 && rows.first().count() > 0 ) {
+        count = rows.first().first().toInt();
+    }
     DPRINT << "SQLITEAPICLI:Count:" << count;
 
     emit tinySqlApiItemCount( (TinySqlApiServerError)status, count );
+    return true;
 }
 
 void TinySqlApi::handleNotification(QDataStream &stream, int response)
 {
     QVariant itemKey;
     stream >> itemKey;
+
+    // Empty key: any item of the table may have changed
+    QString key = itemKey.toString();
+    invalidateCached(key);
+    if( key.isEmpty() ? subscriptions.isEmpty() : !subscriptions.contains(key) ) {
+        // Subscribed only for the read cache
+        return;
+    }
     if (response == int(UpdateNotification)) {
         emit tinySqlApiUpdateNotification( itemKey );
     }
@@ -519,8 +1238,17 @@ void TinySqlApi::handleNewData(QDataStream &stream)
     stream >> response;
     DPRINT << "SQLITEAPICLI:Response:" << response;
 
+    // Sequence number of the request, 0 for notifications
+    int seq;
+    stream >> seq;
+    DPRINT << "SQLITEAPICLI:Request id:" << seq;
+    responseId = seq;
+
     int status;
 
+    // Multi-frame responses are complete only after their last frame
+    bool complete = true;
+
     switch( response )
     {
     case InitializedRes:
@@ -530,19 +1258,29 @@ void TinySqlApi::handleNewData(QDataStream &stream)
         
     // Response to read(id), readAll (list of QVariant's list)
     case ItemDataRes:
-        handleItemDataRes( stream );
+        if( streamedRequests.contains(seq) && (streamPaused || !heldChunks.isEmpty()) ) {
+            // Frame is copied, ring space of it is reused when the later frames are credited
+            QBuffer *buffer = qobject_cast<QBuffer *>(stream.device());
+            if( buffer ) {
+                heldChunks.append(QByteArray(buffer->data().constData(), buffer->data().size()));
+                clientNotifier->holdFrame();
+                complete = false;
+                break;
+            }
+        }
+        complete = handleItemDataRes( stream, seq );
         break;
 
     case TablesRes:
-        handleTablesDataRes( stream );
+        complete = handleTablesDataRes( stream, seq );
         break;
 
     case ColumnsRes:
-        handleColumnsDataRes( stream );
+        complete = handleColumnsDataRes( stream, seq );
         break;
 
     case CountRes:
-        handleCountRes( stream );
+        complete = handleCountRes( stream, seq );
         break;
 
     case WriteGenItemRes:
@@ -551,6 +1289,48 @@ void TinySqlApi::handleNewData(QDataStream &stream)
         emit tinySqlApiWrite( (TinySqlApiServerError)status );
         break;
 
+    // Cancelled request was never executed, responseRequestId() tells which one
+    case CancelRes:
+        stream >> status;
+        DPRINT << "SQLITEAPICLI:CancelRes:" << seq;
+        requestCancelled( seq, status );
+        break;
+
+    case IndexRes:
+        stream >> status;
+        DPRINT << "SQLITEAPICLI:IndexRes:" << status;
+        emit tinySqlApiIndex( (TinySqlApiServerError)status );
+        break;
+
+    case IndexesRes:
+        complete = handleIndexesDataRes( stream, seq );
+        break;
+
+    case StatsRes:
+        complete = handleStatsRes( stream, seq );
+        break;
+
+    case TransactionRes:
+        stream >> status;
+        DPRINT << "SQLITEAPICLI:TransactionRes:" << status;
+        if( seq == 0 ) {
+            // Rolled back by the server
+            invalidateCached(QString());
+        }
+        emit tinySqlApiTransaction( (TinySqlApiServerError)status );
+        break;
+
+    case WriteGenItemsRes: {
+        int written;
+        QList<int> failedItems;
+        stream >> status;
+        stream >> written;
+        stream >> failedItems;
+        DPRINT << "SQLITEAPICLI:WriteGenItemsRes:" << status << ", written:" << written;
+        emit tinySqlApiWriteItems( (TinySqlApiServerError)status, written, failedItems );
+        break;
+    }
+
     case DeleteRes:
         stream >> status;
         DPRINT << "SQLITEAPICLI:Delete:" << status;
@@ -575,12 +1355,14 @@ void TinySqlApi::handleNewData(QDataStream &stream)
         //Error
         DPRINT << "SQLITEAPICLI:ERR, handleNewData:" << response << "is not valid case!";
         //Q_ASSERT(false);
-        clientNotifier->confirmReadyToReceiveNext();
+        responseId = 0;
         return;
         break;
     }
-    client->serverResponseReceived();
-    clientNotifier->confirmReadyToReceiveNext();
+    responseId = 0;
+    if( seq > 0 && complete ) {
+        client->serverResponseReceived(seq);
+    }
 }
 
 // Signals
@@ -593,13 +1375,42 @@ void TinySqlApi::handleNewData(QDataStream &stream)
  */
 
 /*!
- * This signal is emitted in response to asynchronous method read
- * and readAll. Signal emitted when the operation is complete.
+ * This signal is emitted in response to asynchronous methods read,
+ * readAll and query. Signal emitted when the operation is complete.
  * \param error - NoError, if operation was successful
  * \param itemList - List of items from the table. Can be empty if not found.
  * void tinySqlApiRead(TinySqlApiServerError error, QList< QList<QVariant> > itemList)
  */
 
+/*!
+ * This signal is emitted in response to asynchronous method streamAll,
+ * once for every batch of rows received.
+ * \param error - NoError, if operation was successful
+ * \param itemList - Rows of this batch, can be empty
+ * \param last - true for the last batch of the result
+ * void tinySqlApiReadChunk(TinySqlApiServerError error, QList< QList<QVariant> > itemList, bool last)
+ */
+
+/*!
+ * This signal is emitted in response to asynchronous methods readRange
+ * and readAfter.
+ * \param error - NoError, if operation was successful
+ * \param itemList - Items of the page, empty if there are no more items
+ * \param next - Continuation: offset of the next page for readRange, primary key
+ *               for readAfter. Invalid if this was the last page.
+ * void tinySqlApiReadPage(TinySqlApiServerError error, QList< QList<QVariant> > itemList, QVariant next)
+ */
+
+/*!
+ * This signal is emitted in response to asynchronous method readMany,
+ * when all the items have been read.
+ * \param error - NoError, if operation was successful
+ * \param itemList - Items found, in no particular order
+ * \param missing - Identifiers of the items not found. If error is set,
+ *                  includes the items that could not be read.
+ * void tinySqlApiReadMany(TinySqlApiServerError error, QList< QList<QVariant> > itemList, QList<QVariant> missing)
+ */
+
 /*!
  * This signal is emitted in response to asynchronous method count
  * Signal emitted when the operation is complete
@@ -608,16 +1419,65 @@ void TinySqlApi::handleNewData(QDataStream &stream)
  *  void tinySqlApiItemCount(TinySqlApiServerError error, int count)
  */
 
+/*!
+ * This signal is emitted in response to asynchronous methods createIndex and dropIndex.
+ * \param error - NoError, if operation was successful,
+ *                AlreadyExistError if an index with the name exists
+ * void tinySqlApiIndex(TinySqlApiServerError error)
+ */
+
+/*!
+ * This signal is emitted in response to asynchronous method listIndexes.
+ * \param error - NoError, if operation was successful
+ * \param indexes - Name and SQL definition of each index. Definition is
+ *                  empty for the indexes SQLite creates for the primary key.
+ * void tinySqlApiIndexesRes(TinySqlApiServerError error, QList< QList<QVariant> > indexes)
+ */
+
+/*!
+ * This signal is emitted in response to asynchronous method readStats.
+ * \param error - NoError, if operation was successful
+ * \param statements - For each statement: SQL, count of executions, query plan,
+ *                     suggested index (empty if none) and 1 if the server created it.
+ *                     Last row has an empty SQL, the count of the row cache lookups
+ *                     and their hits and misses as the plan.
+ * void tinySqlApiStats(TinySqlApiServerError error, QList< QList<QVariant> > statements)
+ */
+
 /*!
  * This signal is emitted in response to asynchronous method writeItems.
  * \param error - NoError, if operation was successful
  * void tinySqlApiWrite(TinySqlApiServerError error)
  */
 
+/*!
+ * This signal is emitted in response to asynchronous method writeItems.
+ * \param error - NoError, if all the items were written,
+ *                otherwise error of the first item that failed
+ * \param written - Count of items written
+ * \param failedItems - Indexes of the items that were not written
+ * void tinySqlApiWriteItems(TinySqlApiServerError error, int written, QList<int> failedItems)
+ */
+
+/*!
+ * This signal is emitted in response to asynchronous methods beginTransaction,
+ * commitTransaction and rollbackTransaction. Also emitted with responseRequestId() 0
+ * when the server has rolled back the transaction of an idle client.
+ * \param error - NoError, if operation was successful
+ * void tinySqlApiTransaction(TinySqlApiServerError error)
+ */
+
+/*!
+ * This signal is emitted when a request cancelled by cancelAsyncRequest was removed
+ * before it was executed. responseRequestId() is the id of the removed request.
+ * \param error - CancelledError
+ * void tinySqlApiCancel(TinySqlApiServerError error)
+ */
+
 /*!
  * The signal is emitted when changes have been made by another client and
  * this client was subscribed for the item changes.
- * \param identifier - Id of the changed item
+ * \param identifier - Id of the changed item, empty if several items may have changed
  * void tinySqlApiUpdateNotification(const QVariant &identifier)
  */
 
@@ -630,7 +1490,7 @@ void TinySqlApi::handleNewData(QDataStream &stream)
 /*!
  * The signal is emitted when item has been deleted by another client,
  * and this client was subscribed for the item changes.
- * \param identifier - Id of the deleted item
+ * \param identifier - Id of the deleted item, empty if the table was deleted
  * void tinySqlApiDeleteNotification(const QVariant &identifier)
  */
 
@@ -5,10 +5,13 @@
 #include <QTimerEvent>
 #include <QVariant>
 #include <QTime>
+#include <QDateTime>
 #include <QCoreApplication>
+#include <limits.h>
 
 #include "sqliteapiserverdefs.h"
 #include "tinysqliteapiclient.h"
+#include "tinysqliteapiframe.h"
 #include "logging.h"
 
 //! Number of retries if connection fails
@@ -19,14 +22,26 @@ const unsigned int TinySqlApiServerConnectRetries = 3;
  * \param request Request id
  * \param msg Request message
  * \param itemKey Request primary key
+ * \param seq Request sequence number
+ * \param params Values bound to the placeholders of the request message
+ * \param deadline Time in ms since epoch the server must respond by, 0 for none
+ * \param database Database handle (file name), empty for the default database
  */
 TinySqlApiClient::TinySqlApiServerRequest::TinySqlApiServerRequest(
     ServerRequestType request, 
     const QString &msg, 
-    const QVariant &itemKey) :
+    const QVariant &itemKey,
+    int seq,
+    const QVariantList &params,
+    qint64 deadline,
+    const QString &database) :
         mRequest(request),
         mMsg(msg),
-        mItemKey(itemKey) {
+        mItemKey(itemKey),
+        mSeq(seq),
+        mParams(params),
+        mDeadline(deadline),
+        mDatabase(database) {
 }
 
 /*! Getter for the request constant id
@@ -53,6 +68,38 @@ QVariant TinySqlApiClient::TinySqlApiServerRequest::itemKey() const {
     return mItemKey;
 }
 
+/*! Getter for the sequence number
+ *
+ * \return Sequence number, echoed by the server in the response
+ */
+int TinySqlApiClient::TinySqlApiServerRequest::seq() const {
+    return mSeq;
+}
+
+/*! Getter for the bound parameters
+ *
+ * \return Values for the placeholders of the SQL statement, in order
+ */
+QVariantList TinySqlApiClient::TinySqlApiServerRequest::params() const {
+    return mParams;
+}
+
+/*! Getter for the deadline
+ *
+ * \return Time in ms since epoch, 0 if the request has no deadline
+ */
+qint64 TinySqlApiClient::TinySqlApiServerRequest::deadline() const {
+    return mDeadline;
+}
+
+/*! Getter for the database handle
+ *
+ * \return Database file name, empty for the default database
+ */
+QString TinySqlApiClient::TinySqlApiServerRequest::database() const {
+    return mDatabase;
+}
+
 //! Destructor    
 TinySqlApiClient::~TinySqlApiClient()
 {
@@ -70,7 +117,12 @@ TinySqlApiClient::~TinySqlApiClient()
     qDeleteAll(mRequestQueue.begin(), mRequestQueue.end());
     mRequestQueue.clear();
 
-    sendRequest(UnregisterReq);
+    // Connection is persistent, unregister is written directly to it
+    if( mConnected ) {
+        TinySqlApiServerRequest unregister(UnregisterReq, "", "", nextSeq());
+        writeRequest(unregister);
+        flush();
+    }
     disconnectFromServer();
 }
 
@@ -81,40 +133,32 @@ TinySqlApiClient::~TinySqlApiClient()
 TinySqlApiClient::TinySqlApiClient(QObject *parent, int clientId) :
     QLocalSocket(parent), mClientId(clientId)
 {
-    mWaitingServerResponse = false;
+    mConnected = false;
     mRetries = 0;
+    mLastSeq = 0;
+    mPipelineDepth = TinySqlApiDefaultPipelineDepth;
+    mRequestTimeout = 0;
+
+    connect(this, SIGNAL(connected()), this, SLOT(handleConnected()));
+    connect(this, SIGNAL(disconnected()), this, SLOT(handleDisconnected()));
+    connect(this, SIGNAL(error(QLocalSocket::LocalSocketError)),
+            this, SLOT(handleError(QLocalSocket::LocalSocketError)));
+    connect(this, SIGNAL(bytesWritten(qint64)), this, SLOT(dataSent(qint64)));
 }
 
 
 /*! 
- *  Connects the localsocket to the Server socket
- *  Connects the signals to slot callbacks.
+ *  Connects the localsocket to the Server socket.
+ *  The connection is kept open for all the following requests,
+ *  nothing is done if the connection exists or is being opened.
  */
 void TinySqlApiClient::connectServer()
 {
-    if( mWaitingServerResponse ) {
-        // We are already connected, server is processing previous request
-        DPRINT << "SQLITEAPICLI:client id" << mClientId << "busy waiting server response, new request just queued";
+    if( mConnected || state() == QLocalSocket::ConnectingState ) {
         return;
     }
 
     mRetries = 0;
-    mWaitingServerResponse = true;
-    mConnected = false;
-    
-    disconnect(this, SIGNAL(connected()), this, SLOT(handleConnected()));	
-    disconnect(this, SIGNAL(disconnected()), this, SLOT(handleDisconnected()));
-    disconnect(this, SIGNAL(error(QLocalSocket::LocalSocketError)),
-               this, SLOT(handleError(QLocalSocket::LocalSocketError)));
-    disconnect(this, SIGNAL(bytesWritten(qint64)), this, SLOT(dataSent(qint64)));
-    disconnect(this, SIGNAL(readyRead()), this, SLOT(handleReceiveConfirmation()));
-	
-    connect(this, SIGNAL(connected()), this, SLOT(handleConnected()));
-    connect(this, SIGNAL(disconnected()), this, SLOT(handleDisconnected()));
-    connect(this, SIGNAL(error(QLocalSocket::LocalSocketError)),
-            this, SLOT(handleError(QLocalSocket::LocalSocketError)));
-    connect(this, SIGNAL(bytesWritten(qint64)), this, SLOT(dataSent(qint64)));
-    connect(this, SIGNAL(readyRead()), this, SLOT(handleReceiveConfirmation()));
 
     DPRINT << "SQLITEAPICLI:client id" << mClientId << "connecting to server";
 
@@ -122,61 +166,189 @@ void TinySqlApiClient::connectServer()
 }
 
 /*! 
- *  Connects the server and sends the request message
+ *  Sends the request message, or queues it if the pipeline is full
  *  \param request The request code
  *  \param msg The request message
  *  \param itemKey Identifier for the item under change (primary key).
  *                 The change notification is based on this key.
+ *  \param params Values bound to the '?' placeholders of the message,
+ *                the server keeps the statement prepared for the next requests
+ *  \return Sequence number of the request, echoed in the server response
  */
-void TinySqlApiClient::sendRequest(ServerRequestType request, const QString &msg, const QVariant &itemKey)
+int TinySqlApiClient::sendRequest(ServerRequestType request, const QString &msg, const QVariant &itemKey,
+                                  const QVariantList &params)
 {
     DPRINT << "SQLITEAPICLI:client id" << mClientId << "enqueued new request:" << msg;
 
-    TinySqlApiServerRequest* serverRequest = new TinySqlApiServerRequest(request, msg, itemKey);
+    int seq = nextSeq();
+    // Deadline runs from the call, also while the request waits in the queue here
+    qint64 deadline = 0;
+    if( mRequestTimeout > 0 ) {
+        deadline = QDateTime::currentMSecsSinceEpoch() + mRequestTimeout;
+    }
+    TinySqlApiServerRequest* serverRequest = new TinySqlApiServerRequest(request, msg, itemKey, seq, params, deadline, mDatabase);
 	Q_CHECK_PTR(serverRequest);	
     mRequestQueue.append( serverRequest );
     
     DPRINT << "SQLITEAPICLI:queue count now:" << mRequestQueue.count();
-    
-    connectServer();
+
+    if( !mConnected ) {
+        connectServer();
+    }
+    else {
+        sendQueuedRequests();
+    }
+    return seq;
 }
 
 /*! 
- *  Connects the server and sends the request message without any message
+ *  Sends the request without any message
  *  \param request The request code
+ *  \return Sequence number of the request
+ */
+int TinySqlApiClient::sendRequest(ServerRequestType request)
+{
+    return sendRequest( request, "", "");
+}
+
+/*! 
+ *  Removes the latest request not yet sent to the server.
+ *  Transaction begin, commit and rollback are not removed.
+ *  \return Sequence number of the removed request, 0 if there is none
+ */
+int TinySqlApiClient::takeLastQueued()
+{
+    if( mRequestQueue.isEmpty() ) {
+        return 0;
+    }
+    ServerRequestType request = mRequestQueue.last()->request();
+    if( request == BeginTransactionReq || request == CommitReq || request == RollbackReq ) {
+        return 0;
+    }
+    TinySqlApiServerRequest *last = mRequestQueue.takeLast();
+    int seq = last->seq();
+    delete last;
+    return seq;
+}
+
+/*! 
+ *  Latest request sent to the server and not yet responded
+ *  \return Sequence number, 0 if there is none
+ */
+int TinySqlApiClient::lastPendingSeq() const
+{
+    return mPendingRequests.isEmpty() ? 0 : mPendingRequests.last();
+}
+
+/*! 
+ *  Sends the cancel of a sent request right away, also when the pipeline
+ *  is full. The cancel does not wait for the response of any request.
+ *  \param seq Sequence number of the request to cancel
+ *  \return Sequence number of the cancel request, 0 if not connected
+ */
+int TinySqlApiClient::sendCancel(int seq)
+{
+    if( !mConnected ) {
+        // Sent requests are not pending anymore when the connection is lost
+        return 0;
+    }
+    TinySqlApiServerRequest cancel(CancelReq, "", seq, nextSeq());
+    writeRequest(cancel);
+    return cancel.seq();
+}
+
+/*! 
+ *  Sets how many requests can be waiting for the response at the same time.
+ *  \param depth Maximum count of outstanding requests, at least 1
+ */
+void TinySqlApiClient::setPipelineDepth(int depth)
+{
+    mPipelineDepth = qMax(1, depth);
+    if( mConnected ) {
+        sendQueuedRequests();
+    }
+}
+
+/*! 
+ *  Sets the deadline of the requests sent after this call.
+ *  \param msecs Time the server has to respond, 0 for no deadline
  */
-void TinySqlApiClient::sendRequest(ServerRequestType request)
+void TinySqlApiClient::setRequestTimeout(int msecs)
 {
-    sendRequest( request, "", "");
+    mRequestTimeout = qMax(0, msecs);
 }
 
 /*! 
- *  Connects the server and sends the next request message from the queue
+ *  Sets the database of the requests sent after this call.
+ *  \param name Database file name, empty for the default database
+ */
+void TinySqlApiClient::setDatabase(const QString &name)
+{
+    mDatabase = name;
+}
+
+/*! 
+ *  Sends requests from the queue using the open connection,
+ *  until the pipeline is full.
  */    
-void TinySqlApiClient::sendNextRequest()
+void TinySqlApiClient::sendQueuedRequests()
 {
-    DPRINT << "SQLITEAPICLI:client id" << mClientId << "dequeue & sending next request";
-    TinySqlApiServerRequest *request = mRequestQueue.dequeue();
-	Q_CHECK_PTR(request);
+    if( mRequestQueue.count() > 0 && mPendingRequests.count() >= mPipelineDepth ) {
+        // Server is processing previous requests
+        DPRINT << "SQLITEAPICLI:client id" << mClientId << "pipeline full, new request just queued";
+        return;
+    }
 
+    while( mRequestQueue.count() > 0 && mPendingRequests.count() < mPipelineDepth ) {
+        DPRINT << "SQLITEAPICLI:client id" << mClientId << "dequeue & sending next request";
+        TinySqlApiServerRequest *request = mRequestQueue.dequeue();
+        Q_CHECK_PTR(request);
+
+        mPendingRequests.append(request->seq());
+        writeRequest(*request);
+        delete request;
+    }
+}
+
+/*! 
+ *  Allocates sequence number for a new request
+ *  \return Sequence number, always positive
+ */    
+int TinySqlApiClient::nextSeq()
+{
+    if( mLastSeq == INT_MAX ) {
+        mLastSeq = 0;
+    }
+    return ++mLastSeq;
+}
+
+/*! 
+ *  Writes single request to the server connection
+ *  \param request The request to be written
+ */    
+void TinySqlApiClient::writeRequest(const TinySqlApiServerRequest &request)
+{
     QByteArray block;
     QDataStream out(&block, QIODevice::WriteOnly);
 
     out.setVersion(int(QDataStream::Qt_4_0));    // Qt_4_0 seems required when Qt version is 4.x
     mRetries = 0;
 
-    DPRINT << "SQLITEAPICLI:client id" << mClientId << "New request:" << int(request->request());
+    DPRINT << "SQLITEAPICLI:client id" << mClientId << "New request:" << int(request.request());
     out << mClientId;
-    out << int(request->request());
+    out << int(request.request());
+    out << request.seq();
 
-    out << request->itemKey();
-    DPRINT << "SQLITEAPICLI:Item key:" << request->itemKey();
-    out << request->msg();
-    //DPRINT << "SQLITEAPICLI:Message:" << request->msg();
+    out << request.itemKey();
+    DPRINT << "SQLITEAPICLI:Item key:" << request.itemKey();
+    out << request.msg();
+    //DPRINT << "SQLITEAPICLI:Message:" << request.msg();
+    out << request.params();
+    out << request.deadline();
+    out << request.database();
 
     DPRINT << "SQLITEAPICLI:client id" << mClientId << "sending";
-    write(block);
-    delete request;
+    TinySqlApiFrame::write(*this, block);
 }
 
 //! Slot for QLocalSocket::connected signal
@@ -185,18 +357,8 @@ void TinySqlApiClient::handleConnected()
     DPRINT << "SQLITEAPICLI:client id" << mClientId << "handleConnected";
     mRetries = 0;
     mConnected = true;
-    // Send the queued request
-    if( mRequestQueue.count() > 0 ) {
-        sendNextRequest();
-    }
-    else{
-        DPRINT << "SQLITEAPICLI:ERR, client id" << mClientId << "connected, but no request found!";
-#ifndef UNITTEST        
-        Q_ASSERT(false);
-#endif
-        mWaitingServerResponse = false;
-        disconnectFromServer();
-    }
+    // Send the queued requests
+    sendQueuedRequests();
 }
 
 //! Slot for QLocalSocket::disconnected signal  
@@ -204,39 +366,32 @@ void TinySqlApiClient::handleDisconnected()
 {
     DPRINT << "SQLITEAPICLI:client id" << mClientId << "handleDisconnected";
     mConnected = false;
-    if( mRequestQueue.count() > 0 && !mWaitingServerResponse) {
+    // Connection is expected to stay open, reconnect if there are requests to be sent
+    if( mRequestQueue.count() > 0 ) {
        connectServer();
     }
 }
 
 /*!
- *  Server sent response for the last request. Next request can be sent.
+ *  Server sent response for the request. Next request can be sent.
+ *  \param seq Sequence number found from the response
  */
-void TinySqlApiClient::serverResponseReceived()
+void TinySqlApiClient::serverResponseReceived(int seq)
 {
-    DPRINT << "SQLITEAPICLI:client id" << mClientId << "serverResponseReceived";
-    mWaitingServerResponse = false;
+    DPRINT << "SQLITEAPICLI:client id" << mClientId << "serverResponseReceived:" << seq;
+    mPendingRequests.removeOne(seq);
 
-    // Check if we have received new requests in the queue while previous request
-    // has been under process. If so, connect then send next request from queue
+    // Check if we have received new requests in the queue while previous requests
+    // have been under process. If so, send next requests from queue
     if( mRequestQueue.count() > 0 ) {
         if( mConnected ) {
             DPRINT << "SQLITEAPICLI:client id" << mClientId << "sending next from queue";
-            mWaitingServerResponse = true;
-            sendNextRequest();
+            sendQueuedRequests();
         }
         else{
             connectServer();
         }
     }
-    else{
-        if( mConnected ) {
-            // Free socket for other clients use
-            DPRINT << "SQLITEAPICLI:client id" << mClientId << "disconnecting server";
-            mConnected = false;
-            disconnectFromServer();
-        }
-    }
 }
 
 //! Slot for QLocalSocket::bytesWritten signal
@@ -245,25 +400,10 @@ void TinySqlApiClient::dataSent(qint64 bytes)
     DPRINT << "SQLITEAPICLI:client:" << mClientId << "dataSent:" << bytes << "bytes";
 }
 
-//! Slot for QLocalSocket::readyRead signal    
-void TinySqlApiClient::handleReceiveConfirmation()
-{
-    DPRINT << "SQLITEAPICLI:client id" << mClientId << "ACK for request received";
-    // Here we can disconnect, server has received our request and ACKed
-    // (in this way socket is free for other clients use)
-
-    if( mConnected ) {
-        // Free socket for other clients use
-        DPRINT << "SQLITEAPICLI:client id" << mClientId << "disconnecting server";
-        mConnected = false;
-        disconnectFromServer();
-    }    
-}
-
 //! Slot for QLocalSocket::error signal   
 void TinySqlApiClient::handleError(QLocalSocket::LocalSocketError socketError)
 {
-    mWaitingServerResponse = false;
+    mPendingRequests.clear();
     mConnected = false;
 
     switch (socketError) {
@@ -7,6 +7,7 @@
 // User includes
 #include "sqliteapiserverdefs.h"
 #include "tinysqliteapiclientnotifier.h"
+#include "tinysqliteapiframe.h"
 #include "logging.h"
 
 // ======== MEMBER FUNCTIONS ========
@@ -18,6 +19,9 @@ TinySqlApiClientNotifier::TinySqlApiClientNotifier(QObject *parent, int clientId
     QLocalServer(parent), mClientId(clientId)
 {
     mSocketNotify =  NULL;
+    mConsumedFrames = 0;
+    mConsumedBytes = 0;
+    mFrameHeld = false;
 }
 
 //! Destructor
@@ -62,6 +66,13 @@ void TinySqlApiClientNotifier::handleNewConnection()
 
     delete mSocketNotify;
     mSocketNotify = NULL;
+    mBuffer.clear();
+    mConsumedFrames = 0;
+    mConsumedBytes = 0;
+    // Server may have been restarted with a new ring
+    if( mRing.isAttached() ) {
+        mRing.detach();
+    }
     mSocketNotify = nextPendingConnection();
     Q_ASSERT(mSocketNotify);
     DPRINT << "SQLITEAPICLI:client id" << mClientId << "connection for server notifications created";
@@ -80,16 +91,84 @@ void TinySqlApiClientNotifier::handleServerResponse()
 #endif
         return;
     }
-    int bytesAvailable = mSocketNotify->bytesAvailable();
-    if( bytesAvailable > 0 ) {
-        QDataStream stream;
-        stream.setDevice( mSocketNotify );
+    // Data is buffered until whole frame is received,
+    // each complete frame is signaled as its own stream
+    mBuffer.append(mSocketNotify->readAll());
+
+    int offset = 0;
+    QByteArray payload;
+    bool corrupted = false;
+
+    while( mSocketNotify && TinySqlApiFrame::take(mBuffer, offset, payload, corrupted) ) {
+        // Large frames are in the shared memory ring, payload is only a doorbell
+        if( !resolveRingFrame(payload) ) {
+            corrupted = true;
+            break;
+        }
+        QDataStream stream(payload);
         stream.setVersion(int(QDataStream::Qt_4_0));
+        mFrameHeld = false;
         emit newDataReceived( stream );
+        if( mFrameHeld ) {
+            // Credited when the receiver releases its copy
+            continue;
+        }
+
+        mConsumedFrames++;
+        mConsumedBytes += payload.size();
+        if( mConsumedFrames >= TinySqlApiServerDefs::TinySqlApiCreditWindowFrames / 2 ||
+            mConsumedBytes >= TinySqlApiServerDefs::TinySqlApiCreditWindowBytes / 2 ) {
+            grantCredits();
+        }
+    }
+
+    if( corrupted ) {
+        DPRINT << "SQLITEAPICLI:ERR, Server sent invalid frame";
+        mBuffer.clear();
     }
     else {
-        DPRINT << "SQLITEAPICLI:ERR, Server sent empty response";
+        mBuffer.remove(0, offset);
     }
+
+    // Everything consumed from this read is credited back with one message
+    grantCredits();
+}
+
+/*! Replaces a shared memory doorbell with the frame it refers to.
+ *  Frame is not copied, the server does not reuse the ring space before
+ *  credits for the frame are granted, so the payload is valid until then.
+ *  \return false if the doorbell can not be resolved.
+ */
+bool TinySqlApiClientNotifier::resolveRingFrame(QByteArray &payload)
+{
+    QDataStream in(payload);
+    in.setVersion(int(QDataStream::Qt_4_0));
+    int type = UndefinedRes;
+    in >> type;
+    if( type != SharedMemoryRes ) {
+        return true;
+    }
+
+    int ringOffset = 0;
+    int length = 0;
+    in >> ringOffset;
+    in >> length;
+
+    if( !mRing.isAttached() ) {
+        QString num;
+        mRing.setKey(TinySqlApiServerDefs::TinySqlApiClientRingName + num.setNum(mClientId));
+        if( !mRing.attach(QSharedMemory::ReadOnly) ) {
+            DPRINT << "SQLITEAPICLI:ERR, client id" << mClientId << "shared memory ring attach failed:" << mRing.errorString();
+            return false;
+        }
+    }
+    if( in.status() != QDataStream::Ok || ringOffset < 0 || length < 0 ||
+        ringOffset > mRing.size() - length ) {
+        DPRINT << "SQLITEAPICLI:ERR, client id" << mClientId << "invalid shared memory doorbell";
+        return false;
+    }
+    payload = QByteArray::fromRawData(static_cast<const char *>(mRing.constData()) + ringOffset, length);
+    return true;
 }
 
 //! Slot for QLocalSocket::disconnected signal
@@ -98,12 +177,34 @@ void TinySqlApiClientNotifier::handleDisconnect()
     DPRINT << "SQLITEAPICLI:ClientNotifier::handleDisconnect";
 }
 
-/*! Has to be called after the last received data is processed.
- *  Otherwise the next 'write' from server process would get missed.
- *  Server queues the responses and sends again until this is called.
+/*! Called by the receiver of newDataReceived to keep the signaled frame.
+ *  Frame is not credited, so the server stops sending batches when its
+ *  share of the window is used. Receiver must copy the frame, ring space
+ *  of it is released with the credits of the frames following it.
+ */
+void TinySqlApiClientNotifier::holdFrame()
+{
+    mFrameHeld = true;
+}
+
+/*! Credits a frame kept with holdFrame() when the receiver has handled it.
+ */
+void TinySqlApiClientNotifier::releaseFrame(int bytes)
+{
+    mConsumedFrames++;
+    mConsumedBytes += bytes;
+    grantCredits();
+}
+
+/*! Grants the server credits for the frames consumed since the last grant.
+ *  Server stops sending when the credit window is used, so this is called
+ *  at least after every read from the socket.
  */
-void TinySqlApiClientNotifier::confirmReadyToReceiveNext()
+void TinySqlApiClientNotifier::grantCredits()
 {
+    if( mConsumedFrames == 0 ) {
+        return;
+    }
     if( !mSocketNotify ) {
         DPRINT << "SQLITEAPICLI:ERR, client id" << mClientId << "TinySqlApiServer::handleRequest, mSocketNotify is null";
 #ifndef UNITTEST        
@@ -112,7 +213,15 @@ void TinySqlApiClientNotifier::confirmReadyToReceiveNext()
         return;
     }
 
-    mSocketNotify->write("ready");  // Write anything
+    QByteArray block;
+    QDataStream out(&block, QIODevice::WriteOnly);
+    out.setVersion(int(QDataStream::Qt_4_0));
+    out << mConsumedFrames;
+
+    DPRINT << "SQLITEAPICLI:client id" << mClientId << "granting credits for" << mConsumedFrames << "frame(s)";
+    TinySqlApiFrame::write(*mSocketNotify, block);
+    mConsumedFrames = 0;
+    mConsumedBytes = 0;
 }
 
 // Signals
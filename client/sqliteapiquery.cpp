@@ -0,0 +1,180 @@
+// Includes
+#include <QRegExp>
+#include <QVector>
+
+#include "tinysqliteapiquery.h"
+
+/*! Constructs new query of all the columns of all the items
+ */
+TinySqlApiQuery::TinySqlApiQuery() :
+    _ascending(true),
+    _limit(-1),
+    _valid(true) {
+}
+
+/*! Selects the columns of the result, all columns if not called
+ *
+ * \param columns Names of the columns in the order of the result
+ */
+TinySqlApiQuery &TinySqlApiQuery::select(const QStringList &columns) {
+    foreach (const QString &column, columns) {
+        _valid = _valid && isIdentifier(column);
+    }
+    _columns = columns;
+    return *this;
+}
+
+/*! Adds condition the items must match, all the conditions must match
+ *
+ * \param column Name of the compared column
+ * \param op Comparison
+ * \param value Compared value, list of the values for In
+ */
+TinySqlApiQuery &TinySqlApiQuery::where(const QString &column, Operator op, const QVariant &value) {
+    _valid = _valid && isIdentifier(column);
+    Condition condition;
+    condition.column = column;
+    condition.op = op;
+    condition.value = value;
+    _conditions.append(condition);
+    return *this;
+}
+
+/*! Sets the order of the items, unordered if not called
+ *
+ * \param column Name of the column to order by
+ * \param ascending False for the descending order
+ */
+TinySqlApiQuery &TinySqlApiQuery::orderBy(const QString &column, bool ascending) {
+    _valid = _valid && isIdentifier(column);
+    _orderBy = column;
+    _ascending = ascending;
+    return *this;
+}
+
+/*! Sets the maximum count of the items
+ *
+ * \param count Maximum count, negative for no limit
+ */
+TinySqlApiQuery &TinySqlApiQuery::limit(int count) {
+    _limit = count;
+    return *this;
+}
+
+/*! Tells if the column names are valid. Names are placed in the
+ *  statement as such, values are always bound.
+ */
+bool TinySqlApiQuery::isValid() const {
+    return _valid;
+}
+
+/*! Compiles the query to a statement, values are bound from params()
+ *
+ * \param table Name of the table
+ * \return SQL statement
+ */
+QString TinySqlApiQuery::statement(const QString &table) const {
+    QString sql("SELECT ");
+    sql.append(_columns.isEmpty() ? QString("*") : _columns.join(", "));
+    sql.append(QString(" FROM %1").arg(table));
+
+    for( int i=0; i<_conditions.count(); i++ ) {
+        const Condition &condition = _conditions.at(i);
+        sql.append(i == 0 ? " WHERE " : " AND ");
+        sql.append(condition.column);
+        switch( condition.op ) {
+        case Less:
+            sql.append(" < ?");
+            break;
+        case Greater:
+            sql.append(" > ?");
+            break;
+        case In: {
+            // One placeholder per value, empty list matches nothing
+            int values = condition.value.toList().count();
+            QStringList placeholders;
+            for( int value=0; value<values; value++ ) {
+                placeholders.append("?");
+            }
+            sql.append(QString(" IN (%1)").arg(placeholders.join(",")));
+            break;
+        }
+        // Range of the BINARY collation, an index of the column can be used
+        case StartsWith:
+            sql.append(" >= ?");
+            if( !prefixEnd(condition.value.toString()).isNull() ) {
+                sql.append(QString(" AND %1 < ?").arg(condition.column));
+            }
+            break;
+        case Equal:
+        default:
+            sql.append(" = ?");
+            break;
+        }
+    }
+
+    if( !_orderBy.isEmpty() ) {
+        sql.append(QString(" ORDER BY %1 %2").arg(_orderBy).arg(_ascending ? "ASC" : "DESC"));
+    }
+    if( _limit >= 0 ) {
+        sql.append(" LIMIT ?");
+    }
+    return sql;
+}
+
+/*! Values of the statement in the order of the placeholders
+ *
+ * \return Values to bind
+ */
+QVariantList TinySqlApiQuery::params() const {
+    QVariantList params;
+    foreach (const Condition &condition, _conditions) {
+        if( condition.op == In ) {
+            params << condition.value.toList();
+        }
+        else if( condition.op == StartsWith ) {
+            QString prefix = condition.value.toString();
+            QString end = prefixEnd(prefix);
+            params << prefix;
+            if( !end.isNull() ) {
+                params << end;
+            }
+        }
+        else {
+            params << condition.value;
+        }
+    }
+    if( _limit >= 0 ) {
+        params << _limit;
+    }
+    return params;
+}
+
+bool TinySqlApiQuery::isIdentifier(const QString &name) {
+    QRegExp identifier("[A-Za-z_][A-Za-z0-9_]*");
+    return identifier.exactMatch(name);
+}
+
+/*! Upper bound of the texts starting with the prefix. SQLite compares the
+ *  texts as UTF-8 bytes, which is the order of the code points, so the
+ *  last code point of the prefix is incremented. Code points already at
+ *  the maximum are dropped, and there is no bound for an empty prefix.
+ *
+ * \return Upper bound, null string if there is none
+ */
+QString TinySqlApiQuery::prefixEnd(const QString &prefix) {
+    QVector<uint> codePoints = prefix.toUcs4();
+    while( !codePoints.isEmpty() ) {
+        uint last = codePoints.last() + 1;
+        if( last >= 0xD800 && last <= 0xDFFF ) {
+            // Surrogates are not code points of their own
+            last = 0xE000;
+        }
+        if( last <= 0x10FFFF ) {
+            codePoints.last() = last;
+            return QString::fromUcs4(codePoints.constData(), codePoints.count());
+        }
+        codePoints.removeLast();
+    }
+    return QString();
+}
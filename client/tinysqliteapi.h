@@ -4,10 +4,16 @@
 // System includes
 #include <QObject>
 #include <QVariant>
+#include <QHash>
+#include <QSet>
+#include <QMap>
+#include <QPair>
+#include <QCache>
 
 // User includes
 #include "tinysqliteapiglobal.h"
 #include "tinysqliteapidefs.h"
+#include "tinysqliteapiquery.h"
 
 // Forward declarations
 class TinySqlApiClient;
@@ -36,6 +42,10 @@ private:
 /*! Sqlite API client API.
  *
  * Sqlite API API class
+ *
+ * Asynchronous methods return the id of the request. Several requests can be
+ * waiting for the response at the same time (see setPipelineDepth()),
+ * responseRequestId() tells which request the emitted signal belongs to.
  */
 class SQLITEAPI_EXPORT TinySqlApi : public QObject
 {
@@ -47,31 +57,66 @@ public:
 
 public:
 
-    void initialize(const TinySqlApiInitializer &identifier,
-                    const QList<TinySqlApiInitializer> &initializers);
-    void read(const QVariant &identifier);
-    void count();
-    void readTables();
-    void readColumns();
-    void readAll(int columnsCount = -1);
-    void subscribeChangeNotifications(const QVariant &identifier);
-    void unsubscribeChangeNotifications(const QVariant &identifier);
-    void writeItem(QVariant &item);
-    void cancelAsyncRequest();
-    void deleteItem(const QVariant &identifier);
-    void deleteAll(const QString &name = "");
+    int initialize(const TinySqlApiInitializer &identifier,
+                   const QList<TinySqlApiInitializer> &initializers);
+    int read(const QVariant &identifier);
+    int readMany(const QList<QVariant> &identifiers);
+    int count();
+    int readTables();
+    int readColumns();
+    int readAll(int columnsCount = -1);
+    int streamAll(int columnsCount = -1);
+    int readRange(int offset, int limit);
+    int readAfter(const QVariant &lastKey, int limit);
+    int query(const TinySqlApiQuery &query);
+    int createIndex(const QString &name, const QStringList &columns, bool unique = false,
+                    const QString &condition = QString());
+    int dropIndex(const QString &name);
+    int listIndexes();
+    int readStats();
+    void pauseStream();
+    void resumeStream();
+    bool isStreamPaused() const;
+    int subscribeChangeNotifications(const QVariant &identifier);
+    int unsubscribeChangeNotifications(const QVariant &identifier);
+    int writeItem(QVariant &item);
+    int writeItems(const QList<QVariant> &items);
+    int beginTransaction();
+    int commitTransaction();
+    int rollbackTransaction();
+    int cancelAsyncRequest();
+    int deleteItem(const QVariant &identifier);
+    int deleteAll(const QString &name = "");
     void setTable(const QString &name);
     void setPrimaryKey(const QString &name);
-    void changeDB(const QString &fileName);
+    int changeDB(const QString &fileName);
+    void setPipelineDepth(int depth);
+    void setRequestTimeout(int msecs);
+    void setReadCache(int items);
+
+    /*! Id of the request the currently emitted signal responds to.
+     *  Valid only inside the slot connected to the response signal,
+     *  0 for change notifications and for the rollback of a timed out transaction.
+     */
+    inline int responseRequestId() const { return responseId; }
 
 signals:
 
     void tinySqlApiServiceInitialized(TinySqlApiServerError error);
     void tinySqlApiRead(TinySqlApiServerError error, QList< QList<QVariant> > itemList);
+    void tinySqlApiReadChunk(TinySqlApiServerError error, QList< QList<QVariant> > itemList, bool last);
+    void tinySqlApiReadPage(TinySqlApiServerError error, QList< QList<QVariant> > itemList, QVariant next);
+    void tinySqlApiReadMany(TinySqlApiServerError error, QList< QList<QVariant> > itemList, QList<QVariant> missing);
     void tinySqlApiTablesRes(TinySqlApiServerError error, QList<QVariant> tables);
     void tinySqlApiColumnsRes(TinySqlApiServerError error, QList<QVariant> columns);
+    void tinySqlApiIndex(TinySqlApiServerError error);
+    void tinySqlApiIndexesRes(TinySqlApiServerError error, QList< QList<QVariant> > indexes);
+    void tinySqlApiStats(TinySqlApiServerError error, QList< QList<QVariant> > statements);
     void tinySqlApiItemCount(TinySqlApiServerError error, int count);
     void tinySqlApiWrite(TinySqlApiServerError error);
+    void tinySqlApiWriteItems(TinySqlApiServerError error, int written, QList<int> failedItems);
+    void tinySqlApiTransaction(TinySqlApiServerError error);
+    void tinySqlApiCancel(TinySqlApiServerError error);
     void tinySqlApiUpdateNotification(const QVariant &identifier);
     void tinySqlApiDelete();
     void tinySqlApiDeleteNotification(const QVariant &identifier);
@@ -81,15 +126,25 @@ private:
 
     Q_DISABLE_COPY(TinySqlApi)
 
-    void handleItemDataRes(QDataStream &stream);
-    void handleTablesDataRes(QDataStream &stream);
-    void handleColumnsDataRes(QDataStream &stream);
-    void handleCountRes(QDataStream &stream);
+    bool decodeRows(QDataStream &stream, int seq, int &status);
+    void subscribeCached(const QString &key);
+    void invalidateCached(const QString &key);
+    void readManyResponded(int seq, int status, const QList< QList<QVariant> > &items);
+    bool handleItemDataRes(QDataStream &stream, int seq);
+    bool handleTablesDataRes(QDataStream &stream, int seq);
+    bool handleColumnsDataRes(QDataStream &stream, int seq);
+    bool handleIndexesDataRes(QDataStream &stream, int seq);
+    bool handleStatsRes(QDataStream &stream, int seq);
+    bool handleCountRes(QDataStream &stream, int seq);
     void handleNotification(QDataStream &stream, int response);
+    void requestCancelled(int seq, int status);
 
 private slots:
 
     void handleNewData(QDataStream &stream);
+    void emitCachedReads();
+    void emitCancelled(int seq);
+    void emitHeldChunks();
 
 private:
 
@@ -108,6 +163,55 @@ private:
     // This tells the structure size(columns)
     int columns;
 
+    // Request id of the response under handling
+    int responseId;
+
+    // Rows received so far for multi-frame results, by request id
+    QHash<int, QList< QList<QVariant> > > pendingRows;
+
+    // Column types of the multi-frame results, by request id
+    QHash<int, QByteArray> pendingSchemas;
+
+    // Requests whose rows are emitted frame by frame, see streamAll()
+    QSet<int> streamedRequests;
+
+    // Chunk frames received while the stream is paused, see pauseStream()
+    bool streamPaused;
+    QList<QByteArray> heldChunks;
+
+    // Page size and offset of the page reads by request id, offset -1 for readAfter()
+    QHash<int, QPair<int, int> > pageRequests;
+
+    // Multi-key read, sent as one or more statements
+    struct ManyRead
+    {
+        QList<QVariant> identifiers;
+        QList< QList<QVariant> > items;
+        int statements;     // Not responded yet
+        int status;
+    };
+
+    // Multi-key reads by the request id returned by readMany(), and
+    // the request ids of their statements
+    QHash<int, ManyRead> manyReads;
+    QHash<int, int> manyStatements;
+
+    // Rows of the read items by primary key, see setReadCache()
+    QCache<QString, QList< QList<QVariant> > > readCache;
+
+    // Reads to be cached when responded: request id, key and cacheGeneration at the time of the request
+    QHash<int, QPair<QString, quint64> > cachedReads;
+
+    // Reads served from the cache, emitted when the control returns to the event loop
+    QMap<int, QList< QList<QVariant> > > cacheHits;
+
+    // Grows on every invalidation, a read older than that is not cached
+    quint64 cacheGeneration;
+
+    // Keys subscribed by the application, and the ones subscribed only for the cache
+    QSet<QString> subscriptions;
+    QSet<QString> cacheSubscriptions;
+
 #ifdef UNITTEST
     friend class UT_TinySqlApi;
 #endif
@@ -11,6 +11,9 @@
 // before submitting new request (overriding)
 const unsigned int TinySqlApiServerAckTimeOutSecs = 10;
 
+//! Default count of requests waiting for the response at the same time
+const int TinySqlApiDefaultPipelineDepth = 32;
+
 /*!
  * Sqlite API client class declaration 
  * Implements client/server socket connection to the Sqlite API server.
@@ -26,16 +29,26 @@ class TinySqlApiClient : public QLocalSocket
     {
     public:
         TinySqlApiServerRequest(ServerRequestType request, const QString &msg, 
-                                const QVariant &itemKey);
+                                const QVariant &itemKey, int seq,
+                                const QVariantList &params = QVariantList(),
+                                qint64 deadline = 0, const QString &database = QString());
     public:
         ServerRequestType request() const;
         QString msg() const;
         QVariant itemKey() const;
+        int seq() const;
+        QVariantList params() const;
+        qint64 deadline() const;
+        QString database() const;
         
     private:
         ServerRequestType mRequest;
         QString mMsg;
         QVariant mItemKey;
+        int mSeq;
+        QVariantList mParams;
+        qint64 mDeadline;
+        QString mDatabase;
     };
 
 public:   
@@ -43,27 +56,35 @@ public:
     virtual ~TinySqlApiClient();
 
 public:
-    void sendRequest(ServerRequestType request, const QString &msg, const QVariant &itemKey);
-    void sendRequest(ServerRequestType request);
-    void sendNextRequest();
-    void serverResponseReceived();
+    int sendRequest(ServerRequestType request, const QString &msg, const QVariant &itemKey,
+                    const QVariantList &params = QVariantList());
+    int sendRequest(ServerRequestType request);
+    int takeLastQueued();
+    int lastPendingSeq() const;
+    int sendCancel(int seq);
+    void sendQueuedRequests();
+    void serverResponseReceived(int seq);
+    void setPipelineDepth(int depth);
+    void setRequestTimeout(int msecs);
+    void setDatabase(const QString &name);
+    int nextSeq();
 
     /*!
-     *  Check if response to last request is still pending
+     *  Check if response to any sent request is still pending
      *  \return true on no response to request yet received from server
      */
-    bool isWaitingForResponse() { return mWaitingServerResponse; }
+    bool isWaitingForResponse() { return !mPendingRequests.isEmpty(); }
 
 private slots:
     void handleError(QLocalSocket::LocalSocketError socketError);
     void handleConnected();
     void handleDisconnected();
     void dataSent(qint64 bytes);
-    void handleReceiveConfirmation();
 
 private:
     Q_DISABLE_COPY(TinySqlApiClient)
     void connectServer();
+    void writeRequest(const TinySqlApiServerRequest &request);
 
 private: // For testing
     #ifdef UNITTEST
@@ -78,11 +99,23 @@ private:
     // Retry count for connect
     unsigned int mRetries;
 
-    // Current socket connection status
+    // Current socket connection status, connection is kept open between requests
     bool mConnected;
 
-    // Current request/response status
-    bool mWaitingServerResponse;
+    // Sequence numbers of the sent requests waiting for the response
+    QList<int> mPendingRequests;
+
+    // Maximum count of sent requests waiting for the response
+    int mPipelineDepth;
+
+    // Time the server has to respond to a new request, 0 for no deadline
+    int mRequestTimeout;
+
+    // Database handle sent with the requests, empty for the default database
+    QString mDatabase;
+
+    // Last allocated request sequence number
+    int mLastSeq;
 
     // Queue for requests, used when waiting for the response
     QQueue<TinySqlApiServerRequest*> mRequestQueue;
@@ -8,7 +8,8 @@ INCLUDEPATH += . ../inc
 # Sources
 SOURCES += sqliteapi.cpp \
     sqliteapiclient.cpp \
-    sqliteapiclientnotifier.cpp
+    sqliteapiclientnotifier.cpp \
+    sqliteapiquery.cpp
 
 DEFINES += SQLITEAPI_NO_EXPORT
 # following define is for export, creates lib
@@ -17,8 +18,11 @@ DEFINES += BUILD_SQLITEAPI
 HEADERS += sqliteapiglobal.h \
     tinysqliteapidefs.h \
     sqliteapiserverdefs.h \
+    tinysqliteapiframe.h \
+    tinysqliterowcodec.h \
     tinysqliteapiclient.h \
     tinysqliteapiclientnotifier.h \
+    tinysqliteapiquery.h \
     tinysqliteapi.h
 
 win32: {
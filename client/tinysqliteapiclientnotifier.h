@@ -2,6 +2,7 @@
 #define _SQLITEAPICLIENTNOTIFIER_H_
 
 #include "QtNetwork/QLocalServer"
+#include <QSharedMemory>
 //#include "mock_qlocalserver.h"
 #include "tinysqliteapiglobal.h"
 #include "tinysqliteapidefs.h"
@@ -22,7 +23,9 @@ public:
 public:
       
     bool startListening();
-    void confirmReadyToReceiveNext();
+    void grantCredits();
+    void holdFrame();
+    void releaseFrame(int bytes);
 
 public:
     inline bool isConnected() { return (mSocketNotify ? true : false); }
@@ -39,6 +42,8 @@ private slots:
     void handleNewConnection();  
 
 private:
+
+    bool resolveRingFrame(QByteArray &payload);
     
     Q_DISABLE_COPY(TinySqlApiClientNotifier)
 
@@ -57,6 +62,19 @@ private: // data
     
     //! Unique client id, used in socket connection naming
     int mClientId;
+
+    //! Received data not yet forming a complete frame
+    QByteArray mBuffer;
+
+    //! Frames and bytes consumed since the last credit grant
+    int mConsumedFrames;
+    int mConsumedBytes;
+
+    //! Receiver keeps the signaled frame, it is credited by releaseFrame()
+    bool mFrameHeld;
+
+    //! Shared memory ring of the server, attached when the first doorbell arrives
+    QSharedMemory mRing;
     };
 
 #endif // _SQLITEAPICLIENTNOTIFIER_H_
@@ -0,0 +1,80 @@
+#ifndef _SQLITEAPIQUERY_H_
+#define _SQLITEAPIQUERY_H_
+
+// System includes
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+#include <QList>
+
+// User includes
+#include "tinysqliteapiglobal.h"
+
+// Class declaration
+//! Query of the items of the table, see TinySqlApi::query().
+/*!
+ * Selects the columns, the conditions the items must match, the order
+ * and the count of the items read. Compiled to one SQL statement with the
+ * values bound as parameters, so only the matching items and columns are
+ * read and sent. The statement is the same for the same query with other
+ * values, the server reuses the prepared statement.
+ *
+ *    Example:
+ *    TinySqlApiQuery query;
+ *    query.select(QStringList() << "service" << "count")
+ *         .where("count", TinySqlApiQuery::Greater, 10)
+ *         .where("service", TinySqlApiQuery::StartsWith, "inv")
+ *         .orderBy("count", false)
+ *         .limit(20);
+ *    api->query(query);
+ */
+class SQLITEAPI_EXPORT TinySqlApiQuery
+{
+public:
+    //! Comparisons of the conditions
+    enum Operator
+    {
+        Equal = 0,
+        Less,
+        Greater,
+        In,             // Value is a QVariantList
+        StartsWith      // Text value, case sensitive prefix as a range of the column
+    };
+
+public:
+    TinySqlApiQuery();
+
+public:
+    TinySqlApiQuery &select(const QStringList &columns);
+    TinySqlApiQuery &where(const QString &column, Operator op, const QVariant &value);
+    TinySqlApiQuery &orderBy(const QString &column, bool ascending = true);
+    TinySqlApiQuery &limit(int count);
+
+    bool isValid() const;
+    QString statement(const QString &table) const;
+    QVariantList params() const;
+
+    // Plain SQL identifier, placed in the statement as such
+    static bool isIdentifier(const QString &name);
+
+    // First text after all the texts starting with the prefix, null if none
+    static QString prefixEnd(const QString &prefix);
+
+private:
+    struct Condition
+    {
+        QString column;
+        Operator op;
+        QVariant value;
+    };
+
+private:
+    QStringList _columns;
+    QList<Condition> _conditions;
+    QString _orderBy;
+    bool _ascending;
+    int _limit;
+    bool _valid;
+};
+
+#endif // _SQLITEAPIQUERY_H_
@@ -11,6 +11,79 @@ namespace TinySqlApiServerDefs
     const QString TinySqlApiServerUniqueKey = "TinySqlApiServerKeyEA012FCB";
     const QString TinySqlApiServerUniqueName = "TinySqlApiReqSocketEA012FCB";
     const QString TinySqlApiClientSocketName = "TinySqlApiRespSocket";
+    const QString TinySqlApiClientRingName = "TinySqlApiRespRing";
+
+    // Response flow control: server may have this many frames or bytes
+    // sent to the client without the client granting more credits
+    const int TinySqlApiCreditWindowFrames = 64;
+    const int TinySqlApiCreditWindowBytes = 1024 * 1024;
+
+    // Batch frames of the open results use at most this part of the window,
+    // the rest is left for the other responses and the notifications
+    const int TinySqlApiScanWindowFrames = TinySqlApiCreditWindowFrames / 2;
+    const int TinySqlApiScanWindowBytes = TinySqlApiCreditWindowBytes / 2;
+
+    // Result rows are packed into batch frames of about this size
+    const int TinySqlApiDefaultBatchBytes = 64 * 1024;
+
+    // Shared memory ring per client for large response frames,
+    // frames of at least TinySqlApiRingMinFrameBytes are passed through it.
+    // Size 0 disables the shared memory transport.
+    const int TinySqlApiDefaultRingBytes = 4 * 1024 * 1024;
+    const int TinySqlApiRingMinFrameBytes = 16 * 1024;
+
+    // Database used by the requests without a database handle
+    const QString TinySqlApiDefaultDatabase = "tinysqlapidb.db";
+
+    // Other databases are closed when they have had no requests and no open
+    // results for this long, and opened again by their next request
+    const int TinySqlApiDatabaseIdleCloseMs = 60000;
+
+    // SQL executors per open database: one writer connection and reader connections
+    // up to the core count, database is used in WAL mode
+    const int TinySqlApiMaxReaders = 4;
+    const QString TinySqlApiWriterConnection = "TinySqlApiWriter";
+    const QString TinySqlApiReaderConnection = "TinySqlApiReader";
+
+    // Group commit of the writes: writes arriving within the window are
+    // committed in one transaction, at most this many writes per commit.
+    // Max writes 1 disables the group commit.
+    const int TinySqlApiGroupCommitMaxWrites = 64;
+    const int TinySqlApiGroupCommitWindowMs = 5;
+
+    // Client transaction pins the writer to the client, it is rolled back
+    // if the client sends no request to the writer within this time
+    const int TinySqlApiTransactionTimeoutMs = 30000;
+
+    // Deadline for the requests that do not carry one, 0 for no deadline
+    const int TinySqlApiDefaultQueryTimeoutMs = 0;
+
+    // Error text of the requests whose deadline has passed
+    const QString TinySqlApiDeadlineErrorText = "deadline expired";
+
+    // Running statement checks for cancellation and deadline every this many virtual machine instructions.
+    // Only read-only statements are interrupted.
+    const int TinySqlApiProgressOps = 1000;
+
+    // Memory budget of the primary key row cache per database, 0 disables
+    const int TinySqlApiRowCacheBytes = 1024 * 1024;
+
+    // Index advisor: read statements executed this many times are explained,
+    // at most this many statements are followed per database
+    const int TinySqlApiAdvisorMinExecutions = 20;
+    const int TinySqlApiAdvisorMaxStatements = 256;
+
+    // Suggested indexes are created automatically when enabled, one at a time
+    // when the database has had no requests for this long
+    const bool TinySqlApiAutoIndex = false;
+    const int TinySqlApiAutoIndexIdleMs = 5000;
+    const QString TinySqlApiAutoIndexPrefix = "tinysqlapi_auto";
+
+    // Count of prepared statements cached per connection
+    const int TinySqlApiStatementCacheSize = 32;
+
+    // How long a connection waits for a lock held by another connection
+    const int TinySqlApiBusyTimeoutMs = 5000;
 }
 
 
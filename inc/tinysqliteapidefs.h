@@ -17,10 +17,18 @@ enum ServerRequestType
     SubscribeNotificationsReq,
     UnsubscribeNotificationsReq,
     WriteGenItemReq,
-    CancelLastReq,
+    CancelReq,          // Cancel of the request whose sequence number is the item key
     DeleteReq,
     DeleteAllReq,
-    ChangeDBReq
+    ChangeDBReq,
+    WriteGenItemsReq,
+    BeginTransactionReq,
+    CommitReq,
+    RollbackReq,
+    CreateIndexReq,
+    DropIndexReq,
+    ReadIndexesReq,
+    StatsReq
 };
 
 //! Server response codes, used in localsocket communication
@@ -38,7 +46,14 @@ enum ServerResponseType
     //ChangeDBRes,
     UpdateNotification,
     DeleteNotification,
-    ConfirmationRes
+    ConfirmationRes,
+    SharedMemoryRes,    // Doorbell: response frame is in the shared memory ring
+    WriteGenItemsRes,
+    TransactionRes,     // Response to begin, commit and rollback
+    CancelRes,          // Request was removed before it was executed
+    IndexRes,           // Response to create and drop of an index
+    IndexesRes,
+    StatsRes            // Statements followed by the index advisor
 };
 
 //! Common server error codes
@@ -48,7 +63,10 @@ enum TinySqlApiServerError
     InitializationError,
     NotFoundError,
     AlreadyExistError,
-    UndefinedError
+    UndefinedError,
+    CancelledError,
+    TimeoutError,       // Deadline of the request passed before or during the execution
+    DatabaseError       // Database of the request can not be opened
 };
 
 #endif // _SQLITEAPIDEFS_H
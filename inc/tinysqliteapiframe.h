@@ -0,0 +1,65 @@
+#ifndef _SQLITEAPIFRAME_H
+#define _SQLITEAPIFRAME_H
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QtEndian>
+
+//! Framing of the messages in the localsocket communication.
+/*!
+ * Every request and response is sent as a frame:
+ * quint32 payload length (big endian) followed by the QDataStream payload.
+ * Several frames can be read with one readyRead() and one frame can be
+ * split into several reads, receiver buffers the data until frame is complete.
+ */
+namespace TinySqlApiFrame
+{
+    //! Size of the frame length header
+    const int HeaderSize = sizeof(quint32);
+
+    //! Maximum accepted payload size, larger header is handled as corrupted stream
+    const quint32 MaxPayloadSize = 64 * 1024 * 1024;
+
+    /*! Writes the payload as one frame to the device
+     *  \return false if the device did not accept all the data
+     */
+    inline bool write(QIODevice &device, const QByteArray &payload)
+    {
+        uchar header[HeaderSize];
+        qToBigEndian<quint32>(quint32(payload.size()), header);
+        if( device.write(reinterpret_cast<const char *>(header), HeaderSize) != HeaderSize ) {
+            return false;
+        }
+        return device.write(payload) == payload.size();
+    }
+
+    /*! Takes the next complete frame from the buffer, starting from the offset.
+     *  Offset is moved over the frame. Caller removes the handled data from the
+     *  buffer after all the complete frames have been taken.
+     *  \param buffer Received data
+     *  \param offset Read position in the buffer
+     *  \param payload Payload of the frame
+     *  \param corrupted Set to true if the length header is not valid
+     *  \return true if a complete frame was found
+     */
+    inline bool take(const QByteArray &buffer, int &offset, QByteArray &payload, bool &corrupted)
+    {
+        corrupted = false;
+        if( buffer.size() - offset < HeaderSize ) {
+            return false;
+        }
+        quint32 length = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(buffer.constData() + offset));
+        if( length > MaxPayloadSize ) {
+            corrupted = true;
+            return false;
+        }
+        if( quint32(buffer.size() - offset - HeaderSize) < length ) {
+            return false;
+        }
+        payload = buffer.mid(offset + HeaderSize, int(length));
+        offset += HeaderSize + int(length);
+        return true;
+    }
+}
+
+#endif // _SQLITEAPIFRAME_H
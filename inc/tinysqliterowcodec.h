@@ -0,0 +1,207 @@
+#ifndef _SQLITEROWCODEC_H
+#define _SQLITEROWCODEC_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QVariant>
+#include <string.h>
+
+//! Binary row format of the result frames.
+/*!
+ * Column types are sent once per result (schema, one byte per column).
+ * SQLite does not enforce the declared types, so every cell is written
+ * with the type of its own value:
+ * - cell type table, 4 bits per cell (null, integer, real, text, blob)
+ * - non-null cells: qint64 and double in native byte order,
+ *   text as UTF-8 and blobs as raw bytes, both prefixed with quint32 length.
+ * Server and client are always in the same host, so native byte order is used.
+ */
+namespace TinySqlApiRowCodec
+{
+    //! Column types of the schema, declared type of the column
+    enum ColumnType
+    {
+        TextColumn = 0,
+        IntegerColumn,
+        RealColumn,
+        BlobColumn
+    };
+
+    //! Types of a single cell
+    enum CellType
+    {
+        NullCell = 0,
+        IntegerCell,
+        RealCell,
+        TextCell,
+        BlobCell
+    };
+
+    //! Maps the Qt variable type of the column to schema column type
+    inline ColumnType columnType(QVariant::Type type)
+    {
+        switch( type ) {
+        case QVariant::Bool:
+        case QVariant::Int:
+        case QVariant::UInt:
+        case QVariant::LongLong:
+        case QVariant::ULongLong:
+            return IntegerColumn;
+        case QVariant::Double:
+            return RealColumn;
+        case QVariant::ByteArray:
+            return BlobColumn;
+        default:
+            return TextColumn;
+        }
+    }
+
+    inline int typeBytes(int columns)
+    {
+        return (columns + 1) / 2;
+    }
+
+    inline void appendRaw(QByteArray &out, const void *data, int size)
+    {
+        out.append(reinterpret_cast<const char *>(data), size);
+    }
+
+    inline void appendBytes(QByteArray &out, const QByteArray &bytes)
+    {
+        quint32 length = quint32(bytes.size());
+        appendRaw(out, &length, sizeof(length));
+        out.append(bytes);
+    }
+
+    //! Writes one cell by the type of its value, returns the type of the cell
+    inline CellType appendCell(QByteArray &out, const QVariant &value)
+    {
+        if( value.isNull() ) {
+            return NullCell;
+        }
+        switch( value.type() ) {
+        case QVariant::Bool:
+        case QVariant::Int:
+        case QVariant::UInt:
+        case QVariant::LongLong:
+        case QVariant::ULongLong: {
+            qint64 integer = value.toLongLong();
+            appendRaw(out, &integer, sizeof(integer));
+            return IntegerCell;
+        }
+        case QVariant::Double: {
+            double real = value.toDouble();
+            appendRaw(out, &real, sizeof(real));
+            return RealCell;
+        }
+        case QVariant::ByteArray:
+            appendBytes(out, value.toByteArray());
+            return BlobCell;
+        default:
+            appendBytes(out, value.toString().toUtf8());
+            return TextCell;
+        }
+    }
+
+    /*! Appends one row to the frame.
+     *  \param out Frame data
+     *  \param schema Column types, one byte per column
+     *  \param row Any object with value(int column) returning QVariant
+     */
+    template <class Row>
+    inline void appendRow(QByteArray &out, const QByteArray &schema, const Row &row)
+    {
+        const int columns = schema.size();
+        const int typePos = out.size();
+        out.append(QByteArray(typeBytes(columns), '\0'));
+        for( int col=0; col<columns; col++ ) {
+            CellType type = appendCell(out, row.value(col));
+            out.data()[typePos + col / 2] |= char(type << ((col % 2) * 4));
+        }
+    }
+
+    inline bool readBytes(const char *data, int size, int &pos, const char *&bytes, int &length)
+    {
+        quint32 rawLength;
+        if( size - pos < int(sizeof(rawLength)) ) {
+            return false;
+        }
+        memcpy(&rawLength, data + pos, sizeof(rawLength));
+        pos += sizeof(rawLength);
+        if( quint32(size - pos) < rawLength ) {
+            return false;
+        }
+        bytes = data + pos;
+        length = int(rawLength);
+        pos += length;
+        return true;
+    }
+
+    /*! Reads one row from the frame.
+     *  \param data Frame data
+     *  \param size Size of the frame data
+     *  \param pos Read position, moved over the row
+     *  \param schema Column types, one byte per column
+     *  \param row Values of the row are appended here
+     *  \return false if the frame ends before the row
+     */
+    inline bool readRow(const char *data, int size, int &pos, const QByteArray &schema, QList<QVariant> &row)
+    {
+        const int columns = schema.size();
+        const int types = typeBytes(columns);
+        if( size - pos < types ) {
+            return false;
+        }
+        const char *type = data + pos;
+        pos += types;
+
+        for( int col=0; col<columns; col++ ) {
+            int cellType = (quint8(type[col / 2]) >> ((col % 2) * 4)) & 0xf;
+            const char *bytes;
+            int length;
+            switch( cellType ) {
+            case NullCell:
+                row.append(QVariant());
+                break;
+            case IntegerCell: {
+                qint64 integer;
+                if( size - pos < int(sizeof(integer)) ) {
+                    return false;
+                }
+                memcpy(&integer, data + pos, sizeof(integer));
+                pos += sizeof(integer);
+                row.append(QVariant(qlonglong(integer)));
+                break;
+            }
+            case RealCell: {
+                double real;
+                if( size - pos < int(sizeof(real)) ) {
+                    return false;
+                }
+                memcpy(&real, data + pos, sizeof(real));
+                pos += sizeof(real);
+                row.append(QVariant(real));
+                break;
+            }
+            case BlobCell:
+                if( !readBytes(data, size, pos, bytes, length) ) {
+                    return false;
+                }
+                row.append(QVariant(QByteArray(bytes, length)));
+                break;
+            case TextCell:
+                if( !readBytes(data, size, pos, bytes, length) ) {
+                    return false;
+                }
+                row.append(QVariant(QString::fromUtf8(bytes, length)));
+                break;
+            default:
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+#endif // _SQLITEROWCODEC_H
@@ -0,0 +1,556 @@
+// Includes
+#include "sqliteapiserverdefs.h"
+#include "sqliteapidatabase.h"
+#include "sqliteapiserver.h"
+#include "sqliteapirequestmsg.h"
+#include "sqliteapiresponsemsg.h"
+#include "sqliteapistorage.h"
+#include "logging.h"
+
+#include <QThread>
+#include <QTimer>
+#include <QDateTime>
+
+TinySqlApiDatabase::~TinySqlApiDatabase()
+{
+    DPRINT << "SQLITEAPISRV:~TinySqlApiDatabase" << mName;
+
+    mRequestQueue.clear();
+    mReadQueue.clear();
+    mDeferredQueue.clear();
+
+    // Connections and the responses they still own are deleted in their executor threads,
+    // the writes held for the group commit are committed there
+    QList<TinySqlApiStorage *> storages = mReaders;
+    storages.append(mWriter);
+    foreach (TinySqlApiStorage *storage, storages) {
+        QMetaObject::invokeMethod(storage, "close", Qt::BlockingQueuedConnection);
+    }
+
+    // Storages are deleted when the executor threads have finished
+    foreach (QThread *thread, mSqlThreads) {
+        thread->quit();
+        thread->wait();
+    }
+    qDeleteAll(mReaders);
+    mReaders.clear();
+    delete mWriter;
+    mWriter = NULL;
+}
+
+TinySqlApiDatabase::TinySqlApiDatabase(QObject *parent, TinySqlApiServer &server, const QString &name, int index) :
+    QObject(parent), mServer(server), mName(name)
+{
+    mTransactionClient = -1;
+    mTransactionSeq = -1;
+    mPendingReads = 0;
+    mRowCountsInTransaction = false;
+    mCountingAll = false;
+    mTransactionTimer = new QTimer(this);
+    Q_CHECK_PTR(mTransactionTimer);
+    mTransactionTimer->setSingleShot(true);
+    mTransactionTimer->setInterval(TinySqlApiServerDefs::TinySqlApiTransactionTimeoutMs);
+    connect(mTransactionTimer, SIGNAL(timeout()), this, SLOT(rollbackTransaction()));
+
+    mLastRequest = QDateTime::currentMSecsSinceEpoch();
+    mIdleTimer = new QTimer(this);
+    Q_CHECK_PTR(mIdleTimer);
+    mIdleTimer->setInterval(TinySqlApiServerDefs::TinySqlApiAutoIndexIdleMs);
+    connect(mIdleTimer, SIGNAL(timeout()), this, SLOT(createSuggestedIndex()));
+
+    // One writer and readers running in parallel, up to the core count.
+    // Connection names are global, the index separates the databases.
+    QString num;
+    num.setNum(index);
+    mWriter = new TinySqlApiStorage( 0, mServer, *this, TinySqlApiServerDefs::TinySqlApiWriterConnection + num, false );
+    Q_CHECK_PTR(mWriter);
+    addStorage(mWriter);
+    connect(mWriter, SIGNAL(rowsCounted(const QStringList &, const QVariantMap &)),
+            this, SLOT(setRowCounts(const QStringList &, const QVariantMap &)));
+
+    int readers = qBound(1, QThread::idealThreadCount(), TinySqlApiServerDefs::TinySqlApiMaxReaders);
+    for( int i=0; i<readers; i++ ) {
+        QString reader;
+        TinySqlApiStorage *storage = new TinySqlApiStorage( 0, mServer, *this,
+            TinySqlApiServerDefs::TinySqlApiReaderConnection + num + "_" + reader.setNum(i), true );
+        Q_CHECK_PTR(storage);
+        mReaders.append(storage);
+        addStorage(storage);
+    }
+}
+
+void TinySqlApiDatabase::addStorage(TinySqlApiStorage *storage)
+{
+    QThread *thread = new QThread(this);
+    Q_CHECK_PTR(thread);
+    storage->moveToThread(thread);
+    mSqlThreads.append(thread);
+
+    connect(storage, SIGNAL(newResponse(TinySqlApiResponseMsg *)), &mServer, SLOT(handleResponse(TinySqlApiResponseMsg *)));
+    connect(storage, SIGNAL(batchEncoded(int, int, const QByteArray &, bool)),
+            &mServer, SLOT(handleBatch(int, int, const QByteArray &, bool)));
+
+    thread->start();
+}
+
+bool TinySqlApiDatabase::open()
+{
+    // Database connections are created in the executor threads, they can be used only there.
+    // Writer first, it creates the database and sets the WAL mode.
+    DPRINT << "SQLITEAPISRV:opening database:" << mName;
+    bool initialized = false;
+    QMetaObject::invokeMethod(mWriter, "initialize", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(bool, initialized));
+    foreach (TinySqlApiStorage *reader, mReaders) {
+        bool readerInitialized = false;
+        QMetaObject::invokeMethod(reader, "initialize", Qt::BlockingQueuedConnection,
+                                  Q_RETURN_ARG(bool, readerInitialized));
+        initialized = initialized && readerInitialized;
+    }
+    if( !initialized ) {
+        DPRINT << "SQLITEAPISRV:ERR, Storage initialize failed for database:" << mName;
+        return false;
+    }
+
+    // Row counts of the existing tables are read by the writer before the first requests
+    mCountingAll = true;
+    QMetaObject::invokeMethod(mWriter, "countRows", Qt::QueuedConnection, Q_ARG(QStringList, QStringList()));
+    return true;
+}
+
+TinySqlApiRequestMsg *TinySqlApiDatabase::getNextRequest(bool reader)
+{
+    TinySqlApiRequestMsg *msg = reader ? mReadQueue.dequeue() : mRequestQueue.dequeue();
+    if( !msg ) {
+        DPRINT << "SQLITEAPISRV:request queue is empty";
+    }
+    return msg;
+}
+
+void TinySqlApiDatabase::enqueueRequest(TinySqlApiRequestMsg *msg)
+{
+    int id = msg->id();
+    ServerRequestType type = msg->type();
+    mLastRequest = QDateTime::currentMSecsSinceEpoch();
+
+    // Inserts find out their exact row delta only for the tables whose count is kept
+    if( type == WriteGenItemReq || type == WriteGenItemsReq ) {
+        QString table = TinySqlApiRowCache::tableOf(msg->request());
+        msg->setCounted(mCountingAll || mRowCounts.contains(table) || mCountingTables.contains(table) ||
+                        (mRowCountsInTransaction && mTransactionRowCounts.contains(table)));
+    }
+    // Requests of the server itself, client id 0, are executed by the writer
+    bool read = msg->isRead() && mPendingWrites.value(id) == 0 && id != mTransactionClient && id != 0;
+
+    if( !read && mTransactionClient != -1 && id != mTransactionClient ) {
+        // Writer is pinned to the transaction of another client
+        DPRINT << "SQLITEAPISRV:defer request of client" << id << ", transaction of client" << mTransactionClient << "is open";
+        mPendingWrites[id]++;
+        mDeferredQueue.enqueue(msg);
+    }
+    else if( read ) {
+        DPRINT << "SQLITEAPISRV:enqueue read request(). Queue count before:" << mReadQueue.count();
+        mPendingReads++;
+        mReadQueue.enqueue(msg);
+        emit newReadRequest();
+    }
+    else {
+        DPRINT << "SQLITEAPISRV:enqueue request(). Queue count before:" << mRequestQueue.count();
+        if( type == BeginTransactionReq && mTransactionClient == -1 ) {
+            mTransactionClient = id;
+            mTransactionSeq = msg->seq();
+        }
+        mPendingWrites[id]++;
+        // Executor owns the message from now on
+        mRequestQueue.enqueue(msg);
+        emit newRequest();
+
+        if( id == mTransactionClient ) {
+            if( type == CommitReq || type == RollbackReq ) {
+                endTransaction();
+            }
+            else {
+                mTransactionTimer->start();
+            }
+        }
+    }
+}
+
+void TinySqlApiDatabase::writeResponded(int id)
+{
+    // Executed by the writer, later reads of the client can go to readers again
+    if( mPendingWrites.value(id) > 0 && --mPendingWrites[id] == 0 ) {
+        mPendingWrites.remove(id);
+    }
+}
+
+void TinySqlApiDatabase::readResponded()
+{
+    if( mPendingReads > 0 ) {
+        mPendingReads--;
+    }
+}
+
+/*
+ * Every request routed to the database is responded. Results are released
+ * by the storages after their last batch or when the client is gone.
+ */
+bool TinySqlApiDatabase::isIdle(int msecs) const
+{
+    if( QDateTime::currentMSecsSinceEpoch() - mLastRequest < msecs ) {
+        return false;
+    }
+    if( mTransactionClient != -1 || !mPendingWrites.isEmpty() || mPendingReads > 0 ) {
+        return false;
+    }
+    if( mWriter->openResults() > 0 ) {
+        return false;
+    }
+    foreach (TinySqlApiStorage *reader, mReaders) {
+        if( reader->openResults() > 0 ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Primary key read is answered from the cache only when the client would
+ * use a reader anyway, its own uncommitted or queued writes are not cached.
+ */
+bool TinySqlApiDatabase::readCached(const TinySqlApiRequestMsg &msg, QByteArray &schema, int &rows, QByteArray &data)
+{
+    if( msg.type() != ReadGenItemReq || msg.params().isEmpty() ||
+        mPendingWrites.value(msg.id()) > 0 || msg.id() == mTransactionClient ) {
+        return false;
+    }
+    // Only the reads by the primary key are cached, other columns are never found
+    QString column = TinySqlApiRowCache::keyColumnOf(msg.request());
+    if( column.isEmpty() ) {
+        return false;
+    }
+    return mRowCache.find(TinySqlApiRowCache::tableOf(msg.request()), column, msg.params().first(), schema, rows, data);
+}
+
+/*
+ * Readers go on reading the committed rows while the transaction is open,
+ * and may cache them again before the commit.
+ */
+void TinySqlApiDatabase::invalidateCached(const TinySqlApiResponseMsg &msg)
+{
+    CachedRow row;
+    row.table = msg.cacheTable();
+    row.column = msg.cacheColumn();
+    row.key = msg.cacheKey();
+    if( row.column.isEmpty() ) {
+        mRowCache.invalidateTable(row.table);
+    }
+    else {
+        mRowCache.invalidate(row.table, row.column, row.key);
+    }
+    if( mRowCountsInTransaction ) {
+        mTransactionRows.append(row);
+    }
+}
+
+/*
+ * Rows of a rolled back transaction are not dropped, the cache has the committed rows.
+ */
+void TinySqlApiDatabase::invalidateCommitted()
+{
+    foreach (const CachedRow &row, mTransactionRows) {
+        if( row.column.isEmpty() ) {
+            mRowCache.invalidateTable(row.table);
+        }
+        else {
+            mRowCache.invalidate(row.table, row.column, row.key);
+        }
+    }
+    mTransactionRows.clear();
+}
+
+/*
+ * Writes that failed have no row delta, rows of a partly failed multi-row
+ * write are still counted. Responses of the open client transaction change
+ * the transaction's counts only.
+ */
+void TinySqlApiDatabase::updateRowCounts(const TinySqlApiResponseMsg &msg)
+{
+    bool succeeded = (msg.queryError() == QSqlError::NoError);
+    QHash<QString, int> &counts = mRowCountsInTransaction ? mTransactionRowCounts : mRowCounts;
+    QString table = msg.cacheTable();
+
+    switch( msg.request() ) {
+    case BeginTransactionReq:
+        mRowCountsInTransaction = succeeded;
+        mTransactionRowCounts = mRowCounts;
+        mTransactionNotifications.clear();
+        mTransactionRows.clear();
+        break;
+
+    case CommitReq:
+        if( succeeded && mRowCountsInTransaction ) {
+            mRowCounts = mTransactionRowCounts;
+        }
+        // Failed commit is rolled back by the writer.
+        // Rows written by the committed transaction are dropped by the server.
+        if( !succeeded ) {
+            mTransactionRows.clear();
+        }
+        mRowCountsInTransaction = false;
+        mTransactionRowCounts.clear();
+        break;
+
+    case RollbackReq:
+        mRowCountsInTransaction = false;
+        mTransactionRowCounts.clear();
+        mTransactionRows.clear();
+        break;
+
+    // Table that already existed keeps its count
+    case CreateTableReq:
+        if( succeeded ) {
+            counts.insert(table, 0);
+        }
+        break;
+
+    case DeleteAllReq:
+        if( succeeded ) {
+            counts.remove(table);
+        }
+        break;
+
+    case WriteGenItemReq:
+    case WriteGenItemsReq:
+    case DeleteReq:
+        if( !msg.isRowDeltaExact() ) {
+            // Counted again by the writer after this write, with SQL meanwhile
+            counts.remove(table);
+            countTable(table);
+        }
+        else if( counts.contains(table) ) {
+            counts[table] += msg.rowDelta();
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/*
+ * Only the count of all the rows of a table is kept. Like the cached reads,
+ * the client's own queued or uncommitted writes are counted with SQL.
+ */
+bool TinySqlApiDatabase::countCached(const TinySqlApiRequestMsg &msg, int &count)
+{
+    if( msg.type() != CountReq || mPendingWrites.value(msg.id()) > 0 || msg.id() == mTransactionClient ) {
+        return false;
+    }
+    // Count of all the rows as the client API builds it, compared as text
+    QString table = TinySqlApiRowCache::tableOf(msg.request());
+    QString statement = msg.request().simplified();
+    if( table.isEmpty() ||
+        (statement.compare("SELECT COUNT(*) FROM " + table, Qt::CaseInsensitive) != 0 &&
+         statement.compare("SELECT COUNT(*) AS NumberOfOrders FROM " + table, Qt::CaseInsensitive) != 0) ) {
+        return false;
+    }
+    QHash<QString, int>::const_iterator i = mRowCounts.constFind(table);
+    if( i == mRowCounts.constEnd() ) {
+        countTable(table);
+        return false;
+    }
+    count = i.value();
+    return true;
+}
+
+/*
+ * Counts the rows of the table in the writer, after the writes queued
+ * before it. The I/O thread does not wait, the counts requested meanwhile
+ * are executed with SQL. The writer looks the name up from the schema.
+ */
+void TinySqlApiDatabase::countTable(const QString &table)
+{
+    if( mCountingAll || mCountingTables.contains(table) ) {
+        return;
+    }
+    mCountingTables.insert(table);
+    DPRINT << "SQLITEAPISRV:counting rows of table:" << table;
+    QMetaObject::invokeMethod(mWriter, "countRows", Qt::QueuedConnection,
+                              Q_ARG(QStringList, QStringList() << table));
+}
+
+/*
+ * Writes responded before the counts are included in them. Counts read
+ * while a client transaction is open include its writes, they are kept
+ * with the counts of the transaction.
+ */
+void TinySqlApiDatabase::setRowCounts(const QStringList &tables, const QVariantMap &counts)
+{
+    DPRINT << "SQLITEAPISRV:rows counted for" << counts.count() << "table(s)";
+    if( tables.isEmpty() ) {
+        mCountingAll = false;
+    }
+    foreach (const QString &table, tables) {
+        mCountingTables.remove(table);
+    }
+    QHash<QString, int> &rowCounts = mRowCountsInTransaction ? mTransactionRowCounts : mRowCounts;
+    QVariantMap::const_iterator i;
+    for( i = counts.constBegin(); i != counts.constEnd(); ++i ) {
+        rowCounts.insert(i.key(), i.value().toInt());
+    }
+}
+
+bool TinySqlApiDatabase::removeRequest(int id, int seq)
+{
+    if( mReadQueue.remove(id, seq) ) {
+        readResponded();
+        return true;
+    }
+    if( !mRequestQueue.remove(id, seq) && !mDeferredQueue.remove(id, seq) ) {
+        return false;
+    }
+    if( --mPendingWrites[id] <= 0 ) {
+        mPendingWrites.remove(id);
+    }
+    return true;
+}
+
+bool TinySqlApiDatabase::abortRunning(int id, int seq)
+{
+    if( mWriter->abortRunning(id, seq) ) {
+        return true;
+    }
+    foreach (TinySqlApiStorage *reader, mReaders) {
+        if( reader->abortRunning(id, seq) ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void TinySqlApiDatabase::removeClient(int id)
+{
+    if( id == mTransactionClient ) {
+        rollbackTransaction();
+    }
+}
+
+/*
+ * Writer was pinned when the begin was queued. The client may have begun
+ * and ended the transaction meanwhile, only the pin of this begin is released.
+ */
+void TinySqlApiDatabase::transactionFailed(int id, int seq)
+{
+    if( id == mTransactionClient && seq == mTransactionSeq ) {
+        DPRINT << "SQLITEAPISRV:ERR, transaction of client" << id << "not started";
+        endTransaction();
+    }
+}
+
+/*
+ * Other clients see the writes of the transaction only when it is committed,
+ * their notifications are dropped if it is rolled back. Follows the writer
+ * responses like the row counts of the transaction.
+ */
+bool TinySqlApiDatabase::deferNotification(ServerResponseType type, const QString &table, const QVariant &itemKey)
+{
+    if( !mRowCountsInTransaction ) {
+        return false;
+    }
+    Notification notification;
+    notification.type = type;
+    notification.table = table;
+    notification.key = itemKey;
+    mTransactionNotifications.append(notification);
+    return true;
+}
+
+QList<TinySqlApiDatabase::Notification> TinySqlApiDatabase::takeNotifications()
+{
+    QList<Notification> notifications = mTransactionNotifications;
+    mTransactionNotifications.clear();
+    return notifications;
+}
+
+/*
+ * Sets the group commit limits of the writer.
+ */
+void TinySqlApiDatabase::setGroupCommit(int maxWrites, int windowMs)
+{
+    QMetaObject::invokeMethod(mWriter, "setGroupCommit", Qt::QueuedConnection,
+                              Q_ARG(int, maxWrites), Q_ARG(int, windowMs));
+}
+
+void TinySqlApiDatabase::setAutoIndex(bool enabled)
+{
+    if( enabled ) {
+        mIdleTimer->start();
+    }
+    else {
+        mIdleTimer->stop();
+    }
+}
+
+/*
+ * Index is created by the writer like the client requests, the readers
+ * go on meanwhile. One index per idle period, the statements are
+ * explained again after it.
+ */
+void TinySqlApiDatabase::createSuggestedIndex()
+{
+    bool idle = QDateTime::currentMSecsSinceEpoch() - mLastRequest >= TinySqlApiServerDefs::TinySqlApiAutoIndexIdleMs;
+    if( !idle || mTransactionClient != -1 || !mPendingWrites.isEmpty() || mReadQueue.count() > 0 ) {
+        return;
+    }
+    QString index = mIndexAdvisor.takeSuggestion();
+    if( index.isEmpty() ) {
+        return;
+    }
+    DPRINT << "SQLITEAPISRV:creating suggested index:" << index;
+
+    // Not a request of any client, client id 0 is never registered and the response is not sent
+    TinySqlApiRequestMsg *msg = new TinySqlApiRequestMsg(0, 0, CreateIndexReq, 0, QVariant(), index,
+                                                         QVariantList(), 0, mName);
+    Q_CHECK_PTR(msg);
+    enqueueRequest(msg);
+}
+
+/*
+ * Unpins the writer, the deferred requests are dispatched again in their order.
+ */
+void TinySqlApiDatabase::endTransaction()
+{
+    DPRINT << "SQLITEAPISRV:transaction of client" << mTransactionClient << "ended";
+    mTransactionClient = -1;
+    mTransactionSeq = -1;
+    mTransactionTimer->stop();
+
+    QList<TinySqlApiRequestMsg *> deferred;
+    while( TinySqlApiRequestMsg *msg = mDeferredQueue.dequeue() ) {
+        deferred.append(msg);
+    }
+    foreach (TinySqlApiRequestMsg *msg, deferred) {
+        if( --mPendingWrites[msg->id()] <= 0 ) {
+            mPendingWrites.remove(msg->id());
+        }
+        enqueueRequest(msg);
+    }
+}
+
+void TinySqlApiDatabase::rollbackTransaction()
+{
+    if( mTransactionClient == -1 ) {
+        return;
+    }
+    DPRINT << "SQLITEAPISRV:rolling back the transaction of client" << mTransactionClient;
+
+    // Not a request of the client, responded with sequence number 0
+    TinySqlApiRequestMsg *msg = new TinySqlApiRequestMsg(0, mTransactionClient, RollbackReq, 0, QVariant(), "ROLLBACK",
+                                                         QVariantList(), 0, mName);
+    Q_CHECK_PTR(msg);
+    mPendingWrites[msg->id()]++;
+    mRequestQueue.enqueue(msg);
+    emit newRequest();
+    endTransaction();
+}
@@ -0,0 +1,201 @@
+#ifndef SQLITEAPIDATABASE_H_
+#define SQLITEAPIDATABASE_H_
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QPair>
+#include <QVariant>
+#include <QStringList>
+#include "tinysqliteapidefs.h"
+#include "sqliteapirequestqueue.h"
+#include "sqliteapirowcache.h"
+#include "sqliteapiindexadvisor.h"
+
+class QThread;
+class QTimer;
+
+class TinySqlApiServer;
+class TinySqlApiStorage;
+class TinySqlApiRequestMsg;
+class TinySqlApiResponseMsg;
+
+/*
+ * Single open database file and its SQL executors: one writer connection
+ * and reader connections, each in its own thread. Requests are routed to
+ * the database by the database handle they carry, so several databases
+ * are used in parallel and do not wait for each other.
+ */
+class TinySqlApiDatabase : public QObject
+{
+    Q_OBJECT
+
+public:
+    //! Constructs new TinySqlApiDatabase, index makes the connection names unique
+    explicit TinySqlApiDatabase(QObject *parent, TinySqlApiServer &server, const QString &name, int index);
+
+    //! Destructor, waits for the executor threads to finish
+    virtual ~TinySqlApiDatabase();
+
+public:
+    // Opens the connections in the executor threads, blocks until done
+    bool open();
+    inline QString name() const { return mName; }
+
+    // Routes the request to the writer or to the readers, takes the ownership
+    void enqueueRequest(TinySqlApiRequestMsg *msg);
+
+    // Get next request from the writer or read queue, called from the SQL executor threads
+    TinySqlApiRequestMsg *getNextRequest(bool reader);
+
+    // Writer has responded to a request of the client
+    void writeResponded(int id);
+
+    // Reader has responded to a request
+    void readResponded();
+
+    // No requests for the given time, nothing queued, executed or being sent.
+    // The database can then be deleted.
+    bool isIdle(int msecs) const;
+
+    // Removes the queued request of the client, false if it is not queued
+    bool removeRequest(int id, int seq);
+
+    // Interrupts the request of the client if a storage is executing it
+    bool abortRunning(int id, int seq);
+
+    // Client is gone, its open transaction is rolled back
+    void removeClient(int id);
+
+    // Begin of the transaction failed, the writer is unpinned
+    void transactionFailed(int id, int seq);
+
+    // Holds the change notification of a write of the open client transaction,
+    // false if no transaction is open and the notification is to be sent now
+    bool deferNotification(ServerResponseType type, const QString &table, const QVariant &itemKey);
+
+    // Notifications held for the transaction, to be sent when it is committed
+    struct Notification
+    {
+        ServerResponseType type;
+        QString table;
+        QVariant key;
+    };
+    QList<Notification> takeNotifications();
+
+    void setGroupCommit(int maxWrites, int windowMs);
+
+    // Primary key reads of the database, shared with the executor threads
+    inline TinySqlApiRowCache &rowCache() { return mRowCache; }
+
+    // Reads the rows of the request from the cache if the client may use it
+    bool readCached(const TinySqlApiRequestMsg &msg, QByteArray &schema, int &rows, QByteArray &data);
+
+    // Drops the cached rows changed by the writer response. Rows of the open
+    // client transaction are recorded and dropped again when it is committed.
+    void invalidateCached(const TinySqlApiResponseMsg &msg);
+    void invalidateCommitted();
+
+    // Adjusts the row counts by the writer response, in the order the writes were executed
+    void updateRowCounts(const TinySqlApiResponseMsg &msg);
+
+    // Row count of the table for a plain count request if the client may use it.
+    // Count of a table not known yet is read by the writer meanwhile.
+    bool countCached(const TinySqlApiRequestMsg &msg, int &count);
+
+    // Read statements and the indexes suggested for them, shared with the executor threads
+    inline TinySqlApiIndexAdvisor &indexAdvisor() { return mIndexAdvisor; }
+
+    // Creates the suggested indexes when the database is idle
+    void setAutoIndex(bool enabled);
+
+signals:
+    // Connected to the writer storage's slot (handleRequest)
+    void newRequest();
+
+    // Connected to the reader storages' slot (handleRequest)
+    void newReadRequest();
+
+private slots:
+    // Rolls back the open client transaction, on timeout or when the client is gone
+    void rollbackTransaction();
+
+    // Counts read by the writer, no tables for all the tables of the database
+    void setRowCounts(const QStringList &tables, const QVariantMap &counts);
+
+    // Checks for idle and creates the next suggested index
+    void createSuggestedIndex();
+
+private:
+    void addStorage(TinySqlApiStorage *storage);
+    void endTransaction();
+    void countTable(const QString &table);
+
+private:
+    TinySqlApiServer &mServer;
+
+    // Database file, also the handle the clients refer to it with
+    QString mName;
+
+    // Shared with the SQL executor threads. Writes and DDL go to the
+    // writer, reads to the read queue taken by the reader connections.
+    TinySqlApiRequestQueue mRequestQueue;
+    TinySqlApiRequestQueue mReadQueue;
+
+    // Requests in the writer per client. Reads of a client with pending
+    // requests in the writer are executed by the writer too, so they see the writes.
+    QHash<int, int> mPendingWrites;
+
+    // Reads queued or executed by the readers and not yet responded
+    int mPendingReads;
+
+    // Client whose transaction is open in the writer, -1 if none. Meanwhile
+    // the writer requests of other clients wait in the deferred queue.
+    int mTransactionClient;
+    int mTransactionSeq;
+    TinySqlApiRequestQueue mDeferredQueue;
+    QTimer *mTransactionTimer;
+
+    TinySqlApiRowCache mRowCache;
+
+    // Cached rows written by the open client transaction, an empty column for the whole table
+    struct CachedRow
+    {
+        QString table;
+        QString column;
+        QVariant key;
+    };
+    QList<CachedRow> mTransactionRows;
+
+    // Exact row counts by table, counted by the writer when the database is opened
+    // and kept up to date by the committed writes. Table missing if its count
+    // is not known. Counts of an open client transaction are kept apart until it is committed.
+    QHash<QString, int> mRowCounts;
+    QSet<QString> mCountingTables;
+    bool mCountingAll;
+    QHash<QString, int> mTransactionRowCounts;
+    bool mRowCountsInTransaction;
+
+    // Change notifications of the open client transaction, in the order of the writes
+    QList<Notification> mTransactionNotifications;
+
+    TinySqlApiIndexAdvisor mIndexAdvisor;
+    QTimer *mIdleTimer;
+
+    // Time of the latest request, ms since epoch
+    qint64 mLastRequest;
+
+    // Database owns the storages, each lives in its own thread
+    TinySqlApiStorage *mWriter;
+    QList<TinySqlApiStorage *> mReaders;
+    QList<QThread *> mSqlThreads;
+
+    #ifdef UNITTEST
+        friend class UT_TinySqlApiDatabase;
+        friend class UT_TinySqlApiServer;
+        friend class UT_TinySqlApiStorage;
+    #endif
+};
+
+#endif /* SQLITEAPIDATABASE_H_ */
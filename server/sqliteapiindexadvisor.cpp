@@ -0,0 +1,189 @@
+// Includes
+#include "sqliteapiserverdefs.h"
+#include "sqliteapiindexadvisor.h"
+#include "sqliteapirowcache.h"
+#include "logging.h"
+
+#include <QMutexLocker>
+#include <QRegExp>
+
+TinySqlApiIndexAdvisor::TinySqlApiIndexAdvisor()
+{
+}
+
+bool TinySqlApiIndexAdvisor::sample(const QString &statement)
+{
+    QMutexLocker locker(&mMutex);
+    QHash<QString, Entry>::iterator i = mEntries.find(statement);
+    if( i == mEntries.end() ) {
+        if( mEntries.count() >= TinySqlApiServerDefs::TinySqlApiAdvisorMaxStatements ) {
+            // Statements seen first are followed, memory stays bounded
+            return false;
+        }
+        Entry entry;
+        entry.executions = 0;
+        entry.explained = false;
+        entry.created = false;
+        i = mEntries.insert(statement, entry);
+    }
+    i->executions++;
+    if( i->explained || i->executions < TinySqlApiServerDefs::TinySqlApiAdvisorMinExecutions ) {
+        return false;
+    }
+    // Taken by this thread, the other executors do not explain it again
+    i->explained = true;
+    return true;
+}
+
+/*
+ * Plan row "SCAN <table>" without an index is a full table scan,
+ * "USE TEMP B-TREE" a sort of the rows read. Scan without conditions
+ * in the order of the primary key reads the rows in the table's own
+ * order, like the first page of a range read, and is not slow.
+ */
+void TinySqlApiIndexAdvisor::setPlan(const QString &statement, const QStringList &plan, const QString &primaryKey)
+{
+    QRegExp fullScan("^SCAN (?:TABLE )?[^\\s]+$", Qt::CaseInsensitive);
+    QRegExp sort("\\bUSE TEMP B-TREE\\b", Qt::CaseInsensitive);
+    QRegExp where("\\bWHERE\\b", Qt::CaseInsensitive);
+    QRegExp orderBy("\\bORDER\\s+BY\\s+(\\w+)", Qt::CaseInsensitive);
+    bool rowOrder = where.indexIn(statement) < 0 && orderBy.indexIn(statement) >= 0 &&
+                    isRowOrder(orderBy.cap(1), primaryKey);
+    bool slow = false;
+    foreach (const QString &detail, plan) {
+        slow = slow || (fullScan.exactMatch(detail.trimmed()) && !rowOrder) || sort.indexIn(detail) >= 0;
+    }
+    QString suggestion = slow ? suggestIndex(statement, primaryKey) : QString();
+
+    QMutexLocker locker(&mMutex);
+    QHash<QString, Entry>::iterator i = mEntries.find(statement);
+    if( i == mEntries.end() ) {
+        return;
+    }
+    i->plan = plan.join("\n");
+    if( i->suggestion != suggestion ) {
+        i->suggestion = suggestion;
+        i->created = false;
+    }
+    if( !suggestion.isEmpty() ) {
+        DPRINT << "SQLITEAPISRV:scan of a recurring statement:" << statement << ", suggested:" << suggestion;
+    }
+}
+
+void TinySqlApiIndexAdvisor::replan()
+{
+    QMutexLocker locker(&mMutex);
+    QHash<QString, Entry>::iterator i;
+    for( i = mEntries.begin(); i != mEntries.end(); ++i ) {
+        i->explained = false;
+    }
+}
+
+QString TinySqlApiIndexAdvisor::takeSuggestion()
+{
+    QMutexLocker locker(&mMutex);
+    QString suggestion;
+    int executions = 0;
+    QHash<QString, Entry>::const_iterator i;
+    for( i = mEntries.constBegin(); i != mEntries.constEnd(); ++i ) {
+        if( !i->suggestion.isEmpty() && !i->created && i->executions > executions ) {
+            suggestion = i->suggestion;
+            executions = i->executions;
+        }
+    }
+    // Several statements may suggest the same index
+    QHash<QString, Entry>::iterator entry;
+    for( entry = mEntries.begin(); entry != mEntries.end(); ++entry ) {
+        if( !suggestion.isEmpty() && entry->suggestion == suggestion ) {
+            entry->created = true;
+        }
+    }
+    return suggestion;
+}
+
+QList< QList<QVariant> > TinySqlApiIndexAdvisor::stats() const
+{
+    QMutexLocker locker(&mMutex);
+    QList< QList<QVariant> > rows;
+    QHash<QString, Entry>::const_iterator i;
+    for( i = mEntries.constBegin(); i != mEntries.constEnd(); ++i ) {
+        QList<QVariant> row;
+        row << i.key() << i->executions << i->plan << i->suggestion << int(i->created);
+        rows.append(row);
+    }
+    return rows;
+}
+
+/*
+ * Columns compared for equality come first, then one range or prefix
+ * column. Without a range column the index also serves the order,
+ * unless the order is the primary key: the rows are in that order already.
+ * Statements are the ones the client API builds, "column op ?" terms
+ * joined with AND.
+ */
+QString TinySqlApiIndexAdvisor::suggestIndex(const QString &statement, const QString &primaryKey)
+{
+    QString table = TinySqlApiRowCache::tableOf(statement);
+    if( table.isEmpty() ) {
+        return QString();
+    }
+
+    int end = statement.length();
+    QRegExp orderBy("\\bORDER\\s+BY\\s+(\\w+)", Qt::CaseInsensitive);
+    int orderPos = orderBy.indexIn(statement);
+    if( orderPos >= 0 ) {
+        end = orderPos;
+    }
+    QRegExp limit("\\bLIMIT\\b", Qt::CaseInsensitive);
+    int limitPos = limit.indexIn(statement);
+    if( limitPos >= 0 && limitPos < end ) {
+        end = limitPos;
+    }
+
+    QStringList equal;
+    QString range;
+    QRegExp where("\\bWHERE\\b", Qt::CaseInsensitive);
+    int wherePos = where.indexIn(statement);
+    if( wherePos >= 0 && wherePos < end ) {
+        QString conditions = statement.mid(wherePos, end - wherePos);
+        QRegExp term("(\\w+)\\s*(<=|>=|=|<|>|\\bIN\\b|\\bLIKE\\b)", Qt::CaseInsensitive);
+        int pos = 0;
+        while( (pos = term.indexIn(conditions, pos)) >= 0 ) {
+            QString column = term.cap(1);
+            QString op = term.cap(2).toUpper();
+            if( op == "=" || op == "IN" ) {
+                if( !equal.contains(column) ) {
+                    equal.append(column);
+                }
+            }
+            else if( range.isEmpty() ) {
+                range = column;
+            }
+            pos += term.matchedLength();
+        }
+    }
+
+    QStringList columns = equal;
+    if( !range.isEmpty() ) {
+        columns.append(range);
+    }
+    else if( orderPos >= 0 && !columns.contains(orderBy.cap(1)) && !isRowOrder(orderBy.cap(1), primaryKey) ) {
+        columns.append(orderBy.cap(1));
+    }
+    if( columns.isEmpty() ) {
+        return QString();
+    }
+    return QString("CREATE INDEX IF NOT EXISTS %1_%2_%3 ON %2 (%4)")
+        .arg(TinySqlApiServerDefs::TinySqlApiAutoIndexPrefix).arg(table)
+        .arg(columns.join("_")).arg(columns.join(", "));
+}
+
+bool TinySqlApiIndexAdvisor::isRowOrder(const QString &column, const QString &primaryKey)
+{
+    if( !primaryKey.isEmpty() && column.compare(primaryKey, Qt::CaseInsensitive) == 0 ) {
+        return true;
+    }
+    return column.compare("rowid", Qt::CaseInsensitive) == 0 ||
+           column.compare("_rowid_", Qt::CaseInsensitive) == 0 ||
+           column.compare("oid", Qt::CaseInsensitive) == 0;
+}
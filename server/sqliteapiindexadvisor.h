@@ -0,0 +1,70 @@
+#ifndef SQLITEAPIINDEXADVISOR_H_
+#define SQLITEAPIINDEXADVISOR_H_
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+
+/*
+ * Index advisor of one database. Counts the executions of the read
+ * statements by their text, values are bound so the text is the shape
+ * of the query. Recurring statements are explained once with
+ * EXPLAIN QUERY PLAN, a full table scan or a sort gets an index
+ * suggested on the columns of its conditions and order.
+ * Sampled in the SQL executor threads, read in the I/O thread.
+ */
+class TinySqlApiIndexAdvisor
+{
+public:
+    //! Construct new TinySqlApiIndexAdvisor
+    TinySqlApiIndexAdvisor();
+
+public:
+    // Counts the execution, true when the caller should explain the statement now
+    bool sample(const QString &statement);
+
+    // Details of the query plan rows, one per line.
+    // Primary key column of the table, empty if none.
+    void setPlan(const QString &statement, const QStringList &plan, const QString &primaryKey);
+
+    // Schema changed, the statements are explained again when executed
+    void replan();
+
+    // Suggested index of the most executed scan not created yet, empty if none.
+    // The index is then reported as created.
+    QString takeSuggestion();
+
+    // Statement, executions, query plan, suggested index and whether it was created
+    QList< QList<QVariant> > stats() const;
+
+    // Index for the conditions and order of the statement, empty if none
+    static QString suggestIndex(const QString &statement, const QString &primaryKey);
+
+private:
+    // Primary key or rowid alias, the table is already in its order
+    static bool isRowOrder(const QString &column, const QString &primaryKey);
+
+private:
+    Q_DISABLE_COPY(TinySqlApiIndexAdvisor)
+
+    struct Entry
+    {
+        int executions;
+        bool explained;
+        QString plan;
+        QString suggestion;
+        bool created;
+    };
+
+    mutable QMutex mMutex;
+    QHash<QString, Entry> mEntries;
+
+#ifdef UNITTEST
+    friend class UT_TinySqlApiIndexAdvisor;
+#endif
+};
+
+#endif /* SQLITEAPIINDEXADVISOR_H_ */
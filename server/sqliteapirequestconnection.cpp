@@ -0,0 +1,141 @@
+// Includes
+#include "sqliteapirequestconnection.h"
+#include "sqliteapirequestmsg.h"
+#include "tinysqliteapiframe.h"
+#include "logging.h"
+#include <QDataStream>
+#include <QLocalSocket>
+
+TinySqlApiRequestConnection::TinySqlApiRequestConnection(QObject *parent, QLocalSocket *socket) :
+    QObject(parent), mClientConnection(socket)
+{
+    mClientId = -1;
+    mRequestCount = 0;
+    mClosed = false;
+
+    connect(mClientConnection, SIGNAL(readyRead()), this, SLOT(handleRequest()));
+    connect(mClientConnection, SIGNAL(disconnected()), this, SLOT(handleDisconnect()));
+    connect(mClientConnection, SIGNAL(error(QLocalSocket::LocalSocketError)),
+            this, SLOT(handleError(QLocalSocket::LocalSocketError)));
+}
+
+TinySqlApiRequestConnection::~TinySqlApiRequestConnection()
+{
+    DPRINT << "SQLITEAPISRV:~TinySqlApiRequestConnection, client:" << mClientId;
+
+    disconnect(mClientConnection, SIGNAL(readyRead()), this, SLOT(handleRequest()));
+    disconnect(mClientConnection, SIGNAL(disconnected()), this, SLOT(handleDisconnect()));
+    disconnect(mClientConnection, SIGNAL(error(QLocalSocket::LocalSocketError)),
+            this, SLOT(handleError(QLocalSocket::LocalSocketError)));
+
+    if( mClientConnection && mClientConnection->isOpen()){
+        DPRINT << "SQLITEAPISRV:closing client socket..";
+        mClientConnection->close();
+        DPRINT << "SQLITEAPISRV:..closed";
+    }
+    mClientConnection->deleteLater();
+}
+
+void TinySqlApiRequestConnection::handleRequest()
+{
+    DPRINT << "SQLITEAPISRV:*************";
+    DPRINT << "SQLITEAPISRV:handleRequest, client:" << mClientId;
+
+    // Data is buffered until whole frame is received,
+    // several frames may be available in the socket, all of them are read here
+    mBuffer.append(mClientConnection->readAll());
+    DPRINT << "SQLITEAPISRV:" << mBuffer.size() << "bytes buffered";
+
+    int offset = 0;
+    QByteArray payload;
+    bool corrupted = false;
+
+    while( TinySqlApiFrame::take(mBuffer, offset, payload, corrupted) ) {
+        // Request contains items in following order: clientId, requestType, sequence number, itemKey, message,
+        // bound parameters, deadline, database handle
+        QDataStream in(payload);
+        in.setVersion(int(QDataStream::Qt_4_0));
+
+        int id;
+        int requestType;
+        int seq;
+        QVariant itemKey;
+        QString message;
+        QVariantList params;
+        qint64 deadline;
+        QString database;
+
+        in >> id;
+        in >> requestType;
+        in >> seq;
+        in >> itemKey;
+        in >> message;
+        in >> params;
+        in >> deadline;
+        in >> database;
+
+        if( in.status() != QDataStream::Ok ) {
+            DPRINT << "SQLITEAPISRV:ERR, corrupted request from client:" << mClientId;
+            continue;
+        }
+
+        mClientId = id;
+        mRequestCount++;
+
+        TinySqlApiRequestMsg *msg = new TinySqlApiRequestMsg(0, id, static_cast<ServerRequestType>(requestType),
+                                                             seq, itemKey, message, params, deadline, database);
+        Q_CHECK_PTR(msg);
+        DPRINT << "SQLITEAPISRV:message read successfully";
+
+        DPRINT << "SQLITEAPISRV:Client-id:" << msg->id();
+        DPRINT << "SQLITEAPISRV:Request code:" << msg->type();
+        DPRINT << "SQLITEAPISRV:Sequence number:" << msg->seq();
+        DPRINT << "SQLITEAPISRV:Item key:" << msg->itemKey();
+        DPRINT << "SQLITEAPISRV:Message:" << msg->request();
+        DPRINT << "SQLITEAPISRV:Deadline:" << msg->deadline();
+        DPRINT << "SQLITEAPISRV:Database:" << msg->database();
+
+        // Server takes the ownership of the message
+        emit newRequest(msg);
+    }
+
+    if( corrupted ) {
+        DPRINT << "SQLITEAPISRV:ERR, invalid frame from client:" << mClientId << ", closing connection";
+        mBuffer.clear();
+        mClientConnection->abort();
+        return;
+    }
+    mBuffer.remove(0, offset);
+}
+
+void TinySqlApiRequestConnection::handleDisconnect()
+{
+    DPRINT << "SQLITEAPISRV:request socket disconnected. Client:" << mClientId;
+    if( !mClosed ) {
+        mClosed = true;
+        emit clientDisconnected(this);
+    }
+}
+
+void TinySqlApiRequestConnection::handleError(QLocalSocket::LocalSocketError socketError)
+{
+    switch (socketError) {
+    case QLocalSocket::ServerNotFoundError:
+        DPRINT << "SQLITEAPISRV:ERR, The host was not found";
+        break;
+    case QLocalSocket::ConnectionRefusedError:
+        DPRINT << "SQLITEAPISRV:ERR, The connection was refused";
+        break;
+    case QLocalSocket::PeerClosedError: // This is OK case actually
+        DPRINT << "SQLITEAPISRV:client closed the connection";
+        break;
+    default:
+        if( mClientConnection ) {
+            DPRINT << "SQLITEAPISRV:ERR, error occurred:" << mClientConnection->errorString();
+        }
+    }
+    if( !mClosed ) {
+        mClosed = true;
+        emit clientDisconnected(this);
+    }
+}
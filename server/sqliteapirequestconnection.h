@@ -0,0 +1,59 @@
+#ifndef SQLITEAPIREQUESTCONNECTION_H_
+#define SQLITEAPIREQUESTCONNECTION_H_
+
+#include <QObject>
+#include <QtNetwork/QLocalSocket>
+
+class TinySqlApiRequestMsg;
+
+/*
+ * Long-lived request connection of a single client.
+ * Client keeps the connection open, every request read from the socket
+ * is signaled to the server right away.
+ */
+class TinySqlApiRequestConnection : public QObject
+{
+    Q_OBJECT
+
+public:
+    //! Construct new TinySqlApiRequestConnection, takes ownership of the socket
+    explicit TinySqlApiRequestConnection(QObject *parent, QLocalSocket *socket);
+
+    //! Destructor
+    virtual ~TinySqlApiRequestConnection();
+
+public:
+    inline int clientId() const { return mClientId; }
+    inline int requestCount() const { return mRequestCount; }
+
+signals:
+    void newRequest(TinySqlApiRequestMsg *msg);
+    void clientDisconnected(TinySqlApiRequestConnection *connection);
+
+private slots:
+    void handleRequest();
+    void handleDisconnect();
+    void handleError(QLocalSocket::LocalSocketError socketError);
+
+private:
+    QLocalSocket *mClientConnection;
+
+    // Client id of the last request read, -1 until first request is received
+    int mClientId;
+
+    // Count of requests read from this connection
+    int mRequestCount;
+
+    // Received data not yet forming a complete frame
+    QByteArray mBuffer;
+
+    // Set when clientDisconnected is signaled, it is signaled only once
+    bool mClosed;
+
+#ifdef UNITTEST
+    friend class UT_TinySqlApiRequestConnection;
+    friend class UT_TinySqlApiServer;
+#endif
+};
+
+#endif /* SQLITEAPIREQUESTCONNECTION_H_ */
@@ -1,6 +1,7 @@
 // Includes
 #include "sqliteapiserverdefs.h"
 #include "sqliteapirequesthandler.h"
+#include "sqliteapirequestconnection.h"
 #include "sqliteapirequestmsg.h"
 #include "qalgorithms.h"
 #include "logging.h"
@@ -10,7 +11,7 @@ TinySqlApiRequestHandler::~TinySqlApiRequestHandler()
     DPRINT << "SQLITEAPISRV:~TinySqlApiRequestHandler IN";
 
     disconnect(this, SIGNAL(newConnection()), this, SLOT(handleNewConnection()));
-    
+
     close();
 
     // Just in case check if there are client connection active
@@ -22,9 +23,9 @@ TinySqlApiRequestHandler::~TinySqlApiRequestHandler()
         clientConnection = NULL;
         clientConnection = nextPendingConnection();
     }
-    
-    DPRINT << "SQLITEAPISRV:~TinySqlApiRequestHandler count:" << mMsgs.count();
-    qDeleteAll(mMsgs);
+
+    DPRINT << "SQLITEAPISRV:~TinySqlApiRequestHandler count:" << mConnections.count();
+    qDeleteAll(mConnections);
     DPRINT << "SQLITEAPISRV:~TinySqlApiRequestHandler OUT";
 }
 
@@ -37,7 +38,7 @@ TinySqlApiRequestHandler::TinySqlApiRequestHandler(QObject *parent) :
 bool TinySqlApiRequestHandler::initialize()
 {
     removeServer(TinySqlApiServerDefs::TinySqlApiServerUniqueName);
-    
+
     if(!listen(TinySqlApiServerDefs::TinySqlApiServerUniqueName)) {
         DPRINT << "SQLITEAPISRV:ERR, RequestHandler listen() failed";
         DPRINT << "SQLITEAPISRV:Error:" << errorString();
@@ -51,46 +52,40 @@ void TinySqlApiRequestHandler::handleNewConnection()
 
     QLocalSocket* clientConnection = nextPendingConnection();
     Q_CHECK_PTR(clientConnection);
-    TinySqlApiRequestMsg *msg = new TinySqlApiRequestMsg(0, clientConnection);
-    DPRINT << "TinySqlApiRequestHandler::handleNewConnection msg" << msg;
-    Q_CHECK_PTR(msg);
-    mMsgs.append(msg);
-    
-    connect(msg, SIGNAL(clientDisconnected(TinySqlApiRequestMsg *)), this, SLOT(handleDisconnect(TinySqlApiRequestMsg *)));
+    TinySqlApiRequestConnection *connection = new TinySqlApiRequestConnection(0, clientConnection);
+    DPRINT << "TinySqlApiRequestHandler::handleNewConnection connection" << connection;
+    Q_CHECK_PTR(connection);
+    mConnections.append(connection);
+
+    // Requests are forwarded to the server as soon as they are read
+    connect(connection, SIGNAL(newRequest(TinySqlApiRequestMsg *)), this, SIGNAL(newRequest(TinySqlApiRequestMsg *)));
+    connect(connection, SIGNAL(clientDisconnected(TinySqlApiRequestConnection *)), this, SLOT(handleDisconnect(TinySqlApiRequestConnection *)));
 }
 
-void TinySqlApiRequestHandler::handleDisconnect(TinySqlApiRequestMsg *msg)
+void TinySqlApiRequestHandler::handleDisconnect(TinySqlApiRequestConnection *connection)
 {
-    // Client has sent the data successfully and disconnected
+    // Client has closed its request connection
     DPRINT << "SQLITEAPISRV:RequestHandler::handleDisconnect";
-	Q_CHECK_PTR( msg );
-
-	disconnect(msg, SIGNAL(clientDisconnected(TinySqlApiRequestMsg *)), this, SLOT(handleDisconnect(TinySqlApiRequestMsg *)));
-	
-    // This is the end of the single request&receive sequence
-    // emit signal to the server object
-    DPRINT << "SQLITEAPISRV:Client-id:" << msg->id();
-    DPRINT << "SQLITEAPISRV:Request code:" << msg->type();
-    DPRINT << "SQLITEAPISRV:Item key:" << msg->itemKey();
-    DPRINT << "SQLITEAPISRV:Message:" << msg->request();
-
-    int index = mMsgs.indexOf(msg);
-    if( msg->state() == TinySqlApiRequestMsg::DataRead || msg->state() == TinySqlApiRequestMsg::Disconnected ) {
-        emit newRequest(msg);
-        if(index != -1){
-            mMsgs.removeAt(index);
-        }
+    Q_CHECK_PTR( connection );
+
+    disconnect(connection, SIGNAL(newRequest(TinySqlApiRequestMsg *)), this, SIGNAL(newRequest(TinySqlApiRequestMsg *)));
+    disconnect(connection, SIGNAL(clientDisconnected(TinySqlApiRequestConnection *)), this, SLOT(handleDisconnect(TinySqlApiRequestConnection *)));
+
+    DPRINT << "SQLITEAPISRV:Client-id:" << connection->clientId();
+    DPRINT << "SQLITEAPISRV:Requests received:" << connection->requestCount();
+
+    int index = mConnections.indexOf(connection);
+    if( index != -1 ) {
+        mConnections.removeAt(index);
     }
-    else{
-        DPRINT << "SQLITEAPISRV:ERR, RequestHandler: not valid request, client socket state:" << msg->state();
-        if(index == -1 || msg->id() == -1){
-            // TBD: this is only for one-client-server apps:
-            // No clients exists anymore, close server
-            emit abnormalDisconnection();
-        }
-        else{
-            delete mMsgs.takeAt(index);
-        }
+
+    if( connection->requestCount() == 0 ) {
+        DPRINT << "SQLITEAPISRV:ERR, RequestHandler: connection closed without any request";
+        // TBD: this is only for one-client-server apps:
+        // No clients exists anymore, close server
+        emit abnormalDisconnection();
     }
-	DPRINT << "SQLITEAPISRV:-------------"; // End of request processing	
+    // Signal is emitted from the connection, delete it later
+    connection->deleteLater();
+	DPRINT << "SQLITEAPISRV:-------------"; // End of connection
 }
@@ -7,6 +7,7 @@
 //#include "../mocks/QLocalSocket.h"
 
 class TinySqlApiRequestMsg;
+class TinySqlApiRequestConnection;
 
 class TinySqlApiRequestHandler : public QLocalServer
 {
@@ -24,7 +25,7 @@ public:
 
 private slots:
     void handleNewConnection();
-    void handleDisconnect(TinySqlApiRequestMsg *msg);
+    void handleDisconnect(TinySqlApiRequestConnection *connection);
    
 signals:
     void newRequest(TinySqlApiRequestMsg *msg);
@@ -32,7 +33,8 @@ signals:
 
 private:
 
-    QList<TinySqlApiRequestMsg*> mMsgs;
+    // Open client connections, one per client
+    QList<TinySqlApiRequestConnection*> mConnections;
     
     #ifdef UNITTEST
         friend class UT_TinySqlApiRequestHandler;
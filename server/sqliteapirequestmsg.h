@@ -3,56 +3,65 @@
 
 #include <QObject>
 #include <QVariant>
-#include <QtNetwork/QLocalSocket>
 #include "tinysqliteapidefs.h"
 
+/*
+ * Single request read from a client's request connection.
+ * Does not own any socket, several messages can be read from the same connection.
+ */
 class TinySqlApiRequestMsg : public QObject
 {
     Q_OBJECT
 
 public:
-    
-    enum ClientSocketState{
-        NotConnected,
-        Connected,
-        DataRead,
-        Disconnected,
-        Error
-    };    
-    
-    //! Construct new TinySqlApiRequestMsg    
-    explicit TinySqlApiRequestMsg(QObject *parent, QLocalSocket *socket);
+    //! Construct new TinySqlApiRequestMsg
+    explicit TinySqlApiRequestMsg(QObject *parent, int id, ServerRequestType type, int seq,
+                                  const QVariant &itemKey, const QString &message,
+                                  const QVariantList &params = QVariantList(), qint64 deadline = 0,
+                                  const QString &database = QString());
 
     //! Destructor
     virtual ~TinySqlApiRequestMsg();
 
 public:
     inline QString request() const { return mMessage; }
+    // Values for the '?' placeholders of the request, in order
+    inline QVariantList params() const { return mParams; }
     inline QVariant itemKey() const { return mItemKey; }
+    // Database handle (file name) of the request, empty for the default database
+    inline QString database() const { return mDatabase; }
+    // Time in ms since epoch the request must be responded by, 0 for none
+    inline qint64 deadline() const { return mDeadline; }
+    inline void setDeadline(qint64 deadline) { mDeadline = deadline; }
+    bool isExpired() const;
     inline int id() const { return mId; }
     inline ServerRequestType type() const { return mRequestType; }
-    inline ClientSocketState state() const { return mState; }
-
-signals:
-    void clientDisconnected(TinySqlApiRequestMsg* msg);
-
-private slots:
-    void handleRequest();
-    void handleDisconnect();
-    void handleError(QLocalSocket::LocalSocketError socketError);
+    // Client's sequence number for the request, echoed in every response
+    inline int seq() const { return mSeq; }
+    // Read-only requests can be executed by the reader connections
+    bool isRead() const;
+    // Row count of the table is kept by the database, the write tells its exact row delta
+    inline bool isCounted() const { return mCounted; }
+    inline void setCounted(bool counted) { mCounted = counted; }
+    // Begin, commit and rollback of a client transaction
+    inline bool isTransactionControl() const
+        { return mRequestType == BeginTransactionReq || mRequestType == CommitReq || mRequestType == RollbackReq; }
 
 private:
-    QLocalSocket *mClientConnection;
     ServerRequestType mRequestType;
     QString mMessage;
     int mId;
+    int mSeq;
     QVariant mItemKey;
-    ClientSocketState mState;
-    
+    QVariantList mParams;
+    qint64 mDeadline;
+    QString mDatabase;
+    bool mCounted;
+
 #ifdef UNITTEST
     friend class UT_TinySqlApiRequestMsg;
-    friend class UT_TinySqlApiServer;    
-#endif    
+    friend class UT_TinySqlApiServer;
+#endif
 };
 
 #endif /* SQLITEAPIREQUESTMSG_H_ */
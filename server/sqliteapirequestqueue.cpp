@@ -0,0 +1,59 @@
+// Includes
+#include "sqliteapirequestqueue.h"
+#include "sqliteapirequestmsg.h"
+#include "logging.h"
+
+#include <QMutexLocker>
+
+TinySqlApiRequestQueue::TinySqlApiRequestQueue()
+{
+}
+
+TinySqlApiRequestQueue::~TinySqlApiRequestQueue()
+{
+    clear();
+}
+
+void TinySqlApiRequestQueue::enqueue(TinySqlApiRequestMsg *msg)
+{
+    QMutexLocker locker(&mMutex);
+    mQueue.enqueue(msg);
+}
+
+TinySqlApiRequestMsg *TinySqlApiRequestQueue::dequeue()
+{
+    QMutexLocker locker(&mMutex);
+    if( mQueue.count() == 0 ) {
+        return NULL;
+    }
+    return mQueue.dequeue();
+}
+
+bool TinySqlApiRequestQueue::remove(int id, int seq)
+{
+    QMutexLocker locker(&mMutex);
+    for( int i=0; i<mQueue.count(); i++ ) {
+        if(mQueue.at(i)->id() == id && mQueue.at(i)->seq() == seq) {
+            if( mQueue.at(i)->isTransactionControl() ) {
+                // Server and writer track the transaction by these
+                return false;
+            }
+            delete mQueue.takeAt(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TinySqlApiRequestQueue::clear()
+{
+    QMutexLocker locker(&mMutex);
+    qDeleteAll(mQueue.begin(), mQueue.end());
+    mQueue.clear();
+}
+
+int TinySqlApiRequestQueue::count() const
+{
+    QMutexLocker locker(&mMutex);
+    return mQueue.count();
+}
@@ -0,0 +1,47 @@
+#ifndef SQLITEAPIREQUESTQUEUE_H_
+#define SQLITEAPIREQUESTQUEUE_H_
+
+#include <QMutex>
+#include <QQueue>
+
+class TinySqlApiRequestMsg;
+
+/*
+ * Queue of the SQL requests between the I/O thread and the SQL executor thread.
+ * Owns the queued messages, dequeue() gives the ownership to the caller.
+ */
+class TinySqlApiRequestQueue
+{
+public:
+    //! Construct new TinySqlApiRequestQueue
+    TinySqlApiRequestQueue();
+
+    //! Destructor, deletes the requests still in the queue
+    ~TinySqlApiRequestQueue();
+
+public:
+    void enqueue(TinySqlApiRequestMsg *msg);
+
+    // Returns NULL if the queue is empty
+    TinySqlApiRequestMsg *dequeue();
+
+    // Removes the queued request of the client, returns false if it is not queued.
+    // Transaction begin, commit and rollback are not removed.
+    bool remove(int id, int seq);
+
+    void clear();
+    int count() const;
+
+private:
+    Q_DISABLE_COPY(TinySqlApiRequestQueue)
+
+    mutable QMutex mMutex;
+    QQueue<TinySqlApiRequestMsg *> mQueue;
+
+#ifdef UNITTEST
+    friend class UT_TinySqlApiRequestQueue;
+    friend class UT_TinySqlApiServer;
+#endif
+};
+
+#endif /* SQLITEAPIREQUESTQUEUE_H_ */
@@ -2,8 +2,13 @@
 #include "sqliteapiserverdefs.h"
 #include "sqliteapiresponsehandler.h"
 #include "sqliteapiserver.h"
+#include "sqliteapiresponsemsg.h"
+#include "tinysqliteapiframe.h"
 #include "logging.h"
 
+#include <QDataStream>
+#include <string.h>
+
 TinySqlApiResponseHandler::~TinySqlApiResponseHandler()
 {
     DPRINT << "SQLITEAPISRV:~TinySqlApiResponseHandler";
@@ -17,13 +22,18 @@ TinySqlApiResponseHandler::~TinySqlApiResponseHandler()
     disconnectFromServer();
 
 #ifdef QT_DEBUG
-    if( mResponseQueue.count() > 0 ) {
-        DPRINT << "SQLITEAPISRV:ERR, there was" << mResponseQueue.count() << "unsent response(s)!";
+    if( unsentResponseCount() > 0 ) {
+        DPRINT << "SQLITEAPISRV:ERR, there was" << unsentResponseCount() << "unsent response(s)!";
 #ifndef UNITTEST
         Q_ASSERT(false);
 #endif
     }
 #endif    
+    foreach (const OpenScan &scan, mScans) {
+        mServer.closeResult(scan.storage, scan.resultId);
+    }
+    mScans.clear();
+    mResponseQueue.clear();
 }
 
 TinySqlApiResponseHandler::TinySqlApiResponseHandler(QObject *parent, TinySqlApiServer &server, int clientId) :
@@ -31,12 +41,18 @@ TinySqlApiResponseHandler::TinySqlApiResponseHandler(QObject *parent, TinySqlApi
 {
     // This object is owned by TinySqlApiServer
     // When TinySqlApiServer destructs, it will delete this object
-    mSending = false;
+    mConnected = false;
+    mUnackedBytes = 0;
     mError = 0;
+    mRingSize = 0;
+    mRingWritePos = 0;
+    mRingUsed = 0;
     mSocketServerName = TinySqlApiServerDefs::TinySqlApiClientSocketName;
     QString num;
     mSocketServerName += num.setNum(mClientId);
 
+    createRing(mServer.ringBytes());
+
     connect(this, SIGNAL(connected()), this, SLOT(notifierConnected()));
     connect(this, SIGNAL(bytesWritten(qint64)), this, SLOT(dataSent(qint64)));
     connect(this, SIGNAL(error(QLocalSocket::LocalSocketError)),
@@ -50,54 +66,121 @@ TinySqlApiResponseHandler::TinySqlApiResponseHandler(QObject *parent, TinySqlApi
 void TinySqlApiResponseHandler::sendData(const QByteArray &data)
 {
     DPRINT << "SQLITEAPISRV:sendData, client:" << mClientId;
-    QByteArray toBeSent;
-
-    if(isFreeToSend())
-    {
-        if(mResponseQueue.count() > 0)
-        {
-            DPRINT << "SQLITEAPISRV:responsehandler send: reading from queue";
-            mResponseQueue.append(data);	// Add new one to the tail
-            toBeSent = mResponseQueue.dequeue();
-        }
-        else {
-            toBeSent = data;
-        }
+
+    // Responses are sent in order, new one goes to the tail and
+    // as many as the client has granted credits for are sent
+    enqueueData(data);
+    dequeueNextResponse();
+}
+
+void TinySqlApiResponseHandler::enqueueData(const QByteArray &data)
+{
+    DPRINT << "SQLITEAPISRV:enqueue, client:" << mClientId;
+    mResponseQueue.append(data);
+}
+
+/*
+ * Adds an open result. Rows are not read here, the next batch frame is
+ * requested from the executor thread only when the client has granted
+ * credits for it, so the memory used by a scan stays constant.
+ */
+void TinySqlApiResponseHandler::enqueueScan(TinySqlApiResponseMsg *msg, ServerResponseType type, TinySqlApiServerError error)
+{
+    DPRINT << "SQLITEAPISRV:enqueue scan, client:" << mClientId;
+    OpenScan scan;
+    scan.resultId = msg->resultId();
+    scan.storage = msg->storage();
+    scan.seq = msg->seq();
+    scan.type = type;
+    scan.error = error;
+    scan.batchRequested = false;
+    mScans.append(scan);
+}
+
+/*
+ * Batch read by the executor thread for an open result. Batches of results
+ * closed meanwhile are ignored. After the last batch the storage has
+ * deleted the result.
+ */
+void TinySqlApiResponseHandler::batchEncoded(int resultId, const QByteArray &block, bool more)
+{
+    int i = 0;
+    while( i < mScans.count() && mScans.at(i).resultId != resultId ) {
+        i++;
     }
-    else
-    {
-        DPRINT << "SQLITEAPISRV:responsehandler is busy, response queued";
-        mResponseQueue.append(data);
+    if( i == mScans.count() || !mScans.at(i).batchRequested ) {
+        DPRINT << "SQLITEAPISRV:responsehandler: batch of a closed result ignored, client:" << mClientId;
         return;
     }
+    if( more ) {
+        // Next result takes its turn
+        OpenScan scan = mScans.takeAt(i);
+        scan.batchRequested = false;
+        mScans.append(scan);
+    }
+    else {
+        mScans.removeAt(i);
+    }
+    sendFrame(block);
+    dequeueNextResponse();
+}
 
-    DPRINT << "SQLITEAPISRV:Responsehandler, writing response..";
-    mSending = true;
-
-    if(isValid()) {
-        write(toBeSent);        
+/*
+ * Drops the rows not yet sent of an open result and ends it with the
+ * cancelled error. Batch being read meanwhile is ignored when it arrives.
+ */
+bool TinySqlApiResponseHandler::cancelScan(int seq)
+{
+    for( int i=0; i<mScans.count(); i++ ) {
+        if( mScans.at(i).seq == seq ) {
+            DPRINT << "SQLITEAPISRV:cancelling open result of request:" << seq;
+            OpenScan scan = mScans.takeAt(i);
+            mServer.closeResult(scan.storage, scan.resultId);
+            QByteArray block;
+            mServer.encodeEndOfResult(scan.seq, scan.type, CancelledError, block);
+            sendData(block);
+            return true;
+        }
     }
-    else{
-        DPRINT << "SQLITEAPISRV:ERR, Responsehandler client socket is no more valid (disconnected?)";
-    }    
+    return false;
 }
 
-void TinySqlApiResponseHandler::enqueueData(const QByteArray &data)
+bool TinySqlApiResponseHandler::isFreeToSend(int bytes) const
 {
-    DPRINT << "SQLITEAPISRV:enqueue, client:" << mClientId;
-    mResponseQueue.append(data);
+    if( !mConnected ) {
+        return false;
+    }
+    if( mUnackedFrames.count() == 0 ) {
+        // Always room for one frame, even if it is larger than the byte window
+        return true;
+    }
+    return mUnackedFrames.count() < TinySqlApiServerDefs::TinySqlApiCreditWindowFrames &&
+           mUnackedBytes + bytes <= TinySqlApiServerDefs::TinySqlApiCreditWindowBytes;
 }
 
-bool TinySqlApiResponseHandler::isFreeToSend() const
+/*
+ * Batches use only a part of the credit window. Client holding back the
+ * batches of a paused stream does not stop the other responses.
+ */
+bool TinySqlApiResponseHandler::isFreeToScan(int bytes) const
 {
-    // If we're sending!=free
-    return !mSending;
+    if( !mConnected ) {
+        return false;
+    }
+    if( mUnackedFrames.count() == 0 ) {
+        return true;
+    }
+    return mUnackedFrames.count() < TinySqlApiServerDefs::TinySqlApiScanWindowFrames &&
+           mUnackedBytes + bytes <= TinySqlApiServerDefs::TinySqlApiScanWindowBytes;
 }
 
 void TinySqlApiResponseHandler::notifierConnected()
 {
-    mSending = false;
+    mConnected = true;
     DPRINT << "SQLITEAPISRV:responsehandler: notifier connected";
+
+    // Responses may have been queued while connecting
+    dequeueNextResponse();
 }
 
 void TinySqlApiResponseHandler::dataSent(qint64 bytes)
@@ -107,40 +190,177 @@ void TinySqlApiResponseHandler::dataSent(qint64 bytes)
 
 void TinySqlApiResponseHandler::handleReceiveConfirmation()
 {
-    DPRINT << "SQLITEAPISRV:responsehandler: ACK received from client:" << mClientId;
+    // Client grants credits in bulk, each credit message tells
+    // how many of the sent frames the client has consumed
+    mCreditBuffer.append(readAll());
+
+    int offset = 0;
+    QByteArray payload;
+    bool corrupted = false;
+    int frames = 0;
 
-    mSending = false;
-    
-    // After last response is sent, check if we have responses waiting in the queue:
+    while( TinySqlApiFrame::take(mCreditBuffer, offset, payload, corrupted) ) {
+        QDataStream in(payload);
+        in.setVersion(int(QDataStream::Qt_4_0));
+        int consumed = 0;
+        in >> consumed;
+        frames += consumed;
+    }
+    if( corrupted ) {
+        DPRINT << "SQLITEAPISRV:ERR, invalid credit frame from client:" << mClientId;
+        mCreditBuffer.clear();
+    }
+    else {
+        mCreditBuffer.remove(0, offset);
+    }
+
+    DPRINT << "SQLITEAPISRV:responsehandler: credits for" << frames << "frame(s) received from client:" << mClientId;
+    releaseCredits(frames);
+
+    // Check if we have responses waiting in the queue:
     dequeueNextResponse();
 }
 
+void TinySqlApiResponseHandler::releaseCredits(int frames)
+{
+    while( frames-- > 0 && mUnackedFrames.count() > 0 ) {
+        SentFrame frame = mUnackedFrames.dequeue();
+        mUnackedBytes -= frame.bytes;
+        mRingUsed -= frame.ringBytes;
+    }
+    if( mRingUsed == 0 ) {
+        // Ring is empty, start again from the beginning to avoid wrapping
+        mRingWritePos = 0;
+    }
+}
+
+void TinySqlApiResponseHandler::createRing(int bytes)
+{
+    if( bytes <= 0 ) {
+        DPRINT << "SQLITEAPISRV:responsehandler: shared memory transport disabled";
+        return;
+    }
+    QString num;
+    mRing.setKey(TinySqlApiServerDefs::TinySqlApiClientRingName + num.setNum(mClientId));
+
+    if( !mRing.create(bytes) ) {
+        // Segment may be left over from a previous server process
+        if( mRing.error() != QSharedMemory::AlreadyExists || !mRing.attach() ) {
+            DPRINT << "SQLITEAPISRV:ERR, shared memory ring not available:" << mRing.errorString();
+            return;
+        }
+    }
+    mRingSize = mRing.size();
+    DPRINT << "SQLITEAPISRV:responsehandler: shared memory ring of" << mRingSize << "bytes for client:" << mClientId;
+}
+
+/*
+ * Copies the frame to the ring if there is contiguous free space for it.
+ * Frame is not split, if it does not fit to the end of the ring it is
+ * written to the beginning and the end is reserved as padding.
+ */
+bool TinySqlApiResponseHandler::writeToRing(const QByteArray &data, int &offset, int &ringBytes)
+{
+    const int length = data.size();
+    if( mRingSize == 0 || length > mRingSize || mRingUsed + length > mRingSize ) {
+        return false;
+    }
+
+    // Oldest unconsumed byte, data occupies [readPos, mRingWritePos) circularly
+    int readPos = (mRingWritePos - mRingUsed + mRingSize) % mRingSize;
+    bool wrapped = mRingUsed > 0 && readPos >= mRingWritePos;
+
+    if( !wrapped && mRingSize - mRingWritePos >= length ) {
+        offset = mRingWritePos;
+        ringBytes = length;
+    }
+    else if( !wrapped && (mRingUsed == 0 || readPos >= length) ) {
+        // Skip the end of the ring
+        offset = 0;
+        ringBytes = mRingSize - mRingWritePos + length;
+        if( mRingUsed + ringBytes > mRingSize ) {
+            return false;
+        }
+    }
+    else if( wrapped && readPos - mRingWritePos >= length ) {
+        offset = mRingWritePos;
+        ringBytes = length;
+    }
+    else {
+        return false;
+    }
+
+    memcpy(static_cast<char *>(mRing.data()) + offset, data.constData(), length);
+    mRingWritePos = (offset + length) % mRingSize;
+    mRingUsed += ringBytes;
+    return true;
+}
+
 void TinySqlApiResponseHandler::dequeueNextResponse()
 {
-    if(mResponseQueue.count() == 0) {
+    if( unsentResponseCount() == 0 ) {
         DPRINT << "SQLITEAPISRV:responsehandler: queue empty";
+        return;
+    }
+
+    DPRINT << unsentResponseCount() << "item(s) in the queue. Client:" << mClientId;
+
+    // Ready frames first, until the queue is empty or the credit window is full
+    while( mResponseQueue.count() > 0 && isFreeToSend(mResponseQueue.head().size()) ) {
+        sendFrame(mResponseQueue.dequeue());
+    }
+
+    // One batch is read at a time, the first result in the list is the next in turn.
+    // Size of the batch is known only after encoding, budget is the upper estimate.
+    // Sending continues when the executor has read the batch.
+    bool reading = false;
+    foreach (const OpenScan &scan, mScans) {
+        reading = reading || scan.batchRequested;
     }
-    else if( isFreeToSend() ) {
-        DPRINT << mResponseQueue.count() << "item(s) in the queue. Client:" << mClientId;
-        DPRINT << "SQLITEAPISRV:responsehandler: sending next from queue";
-        QByteArray toBeSent = mResponseQueue.dequeue();
+    if( !reading && mScans.count() > 0 && isFreeToScan(mServer.batchBytes()) ) {
+        OpenScan &next = mScans.first();
+        next.batchRequested = true;
+        mServer.readNextBatch(next.storage, next.resultId, next.type, next.error);
+    }
+
+    if( unsentResponseCount() > 0 ) {
+        DPRINT << "SQLITEAPISRV:responsehandler: waiting credits," << mUnackedFrames.count() << "frame(s) unacknowledged";
+    }
+}
 
-        mSending = true;
+void TinySqlApiResponseHandler::sendFrame(const QByteArray &toBeSent)
+{
+    if(isValid()) {
+        SentFrame frame;
+        frame.bytes = toBeSent.size();
+        frame.ringBytes = 0;
 
-        if(isValid()) {
-            write(toBeSent);        
+        int offset = 0;
+        if( toBeSent.size() >= TinySqlApiServerDefs::TinySqlApiRingMinFrameBytes &&
+            writeToRing(toBeSent, offset, frame.ringBytes) ) {
+            // Frame is in the ring, only the doorbell goes through the socket
+            QByteArray doorbell;
+            QDataStream out(&doorbell, QIODevice::WriteOnly);
+            out.setVersion(int(QDataStream::Qt_4_0));
+            out << int(SharedMemoryRes);
+            out << offset;
+            out << toBeSent.size();
+            TinySqlApiFrame::write(*this, doorbell);
         }
-        else{
-            DPRINT << "SQLITEAPISRV:ERR, Responsehandler client socket is no more valid (disconnected?)";
-        }  
+        else {
+            TinySqlApiFrame::write(*this, toBeSent);
+        }
+        mUnackedFrames.enqueue(frame);
+        mUnackedBytes += frame.bytes;
     }
     else{
+        DPRINT << "SQLITEAPISRV:ERR, Responsehandler client socket is no more valid (disconnected?)";
     }
 }
 
 void TinySqlApiResponseHandler::handleError(QLocalSocket::LocalSocketError socketError)
 {
-    mSending = false;
+    mConnected = false;
     mError = int(socketError);
 
     switch (socketError) {
@@ -160,25 +380,32 @@ void TinySqlApiResponseHandler::handleError(QLocalSocket::LocalSocketError socke
     mServer.removeClientId(mClientId);
 }
 
-bool TinySqlApiResponseHandler::isSubscribedFor(const QVariant& key)
+bool TinySqlApiResponseHandler::isSubscribedFor(const QString &scope, const QVariant& key)
 {
-    if( mSubscribedItemKeys.indexOf(key) >= 0 ) {
+    if( mSubscribedItemKeys.value(scope).indexOf(key) >= 0 ) {
         return true;
     }
     return false;
 }
 
-void TinySqlApiResponseHandler::subscribeForNotifications( const QVariant &key )
+void TinySqlApiResponseHandler::subscribeForNotifications( const QString &scope, const QVariant &key )
 {
-    removeSubscription(key);
-    mSubscribedItemKeys.append(key);
+    removeSubscription(scope, key);
+    mSubscribedItemKeys[scope].append(key);
 }
 
-bool TinySqlApiResponseHandler::removeSubscription( const QVariant &key )
+bool TinySqlApiResponseHandler::removeSubscription( const QString &scope, const QVariant &key )
 {
-    int i=mSubscribedItemKeys.indexOf(key);
+    QHash<QString, QList<QVariant> >::iterator keys = mSubscribedItemKeys.find(scope);
+    if( keys == mSubscribedItemKeys.end() ) {
+        return false;
+    }
+    int i=keys.value().indexOf(key);
     if(i>=0) {
-        mSubscribedItemKeys.removeAt(i);
+        keys.value().removeAt(i);
+        if( keys.value().isEmpty() ) {
+            mSubscribedItemKeys.erase(keys);
+        }
         return true;
     }
     return false;
@@ -2,6 +2,7 @@
 #define SQLITEAPIRESPONSEHANDLER_H_
 
 #include <QLocalSocket>
+#include <QSharedMemory>
 #include "sqliteapiserver.h"
 
 class TinySqlApiResponseHandler : public QLocalSocket
@@ -18,15 +19,21 @@ public:
 public:
     void sendData(const QByteArray &data);
     void enqueueData(const QByteArray &data);
+    void enqueueScan(TinySqlApiResponseMsg *msg, ServerResponseType type, TinySqlApiServerError error);
+    void batchEncoded(int resultId, const QByteArray &block, bool more);
+    bool cancelScan(int seq);
     inline int lastError() const { return mError; }
     inline int clientId() const { return mClientId; }
-    inline int unsentResponseCount() const { return mResponseQueue.count(); }
+    inline int unsentResponseCount() const { return mResponseQueue.count() + mScans.count(); }
 
-    bool isSubscribedFor( const QVariant& key );
-    void subscribeForNotifications( const QVariant& key );
-    bool removeSubscription( const QVariant& key );
+    bool isSubscribedFor( const QString &scope, const QVariant& key );
+    inline bool hasSubscriptions( const QString &scope ) const { return mSubscribedItemKeys.contains(scope); }
+    void subscribeForNotifications( const QString &scope, const QVariant& key );
+    bool removeSubscription( const QString &scope, const QVariant& key );
     void dequeueNextResponse();
-    bool isFreeToSend() const;
+    bool isFreeToSend(int bytes) const;
+    bool isFreeToScan(int bytes) const;
+    inline int unackedFrameCount() const { return mUnackedFrames.count(); }
 
 private slots:
     void notifierConnected();    
@@ -35,18 +42,63 @@ private slots:
     void dataSent(qint64);
 
 private:
+    void releaseCredits(int frames);
+    void sendFrame(const QByteArray &data);
+    void createRing(int bytes);
+    bool writeToRing(const QByteArray &data, int &offset, int &ringBytes);
+
+private:
+    // Open result whose rows are encoded to batch frames only when there is room to send
+    struct OpenScan
+    {
+        // Id of the open result in the executor thread, the storage owns and reads the result
+        int resultId;
+        TinySqlApiStorage *storage;     // Owner of the open result
+        int seq;
+        ServerResponseType type;
+        TinySqlApiServerError error;
+        bool batchRequested;    // Waiting for the executor to read the next batch
+    };
+
+    // Frame sent but not yet credited back by the client
+    struct SentFrame
+    {
+        int bytes;      // Size of the response frame
+        int ringBytes;  // Space reserved from the ring, including wrap padding
+    };
+
+    // Ready frames, sent in order ahead of the batches of the open results
     QQueue<QByteArray> mResponseQueue;
 
+    // Open results, one batch is read at a time and the results take turns
+    QList<OpenScan> mScans;
+
+    // Frames sent but not yet credited back by the client, oldest first
+    QQueue<SentFrame> mUnackedFrames;
+
+    // Total size of the frames in mUnackedFrames
+    qint64 mUnackedBytes;
+
+    // Credit messages from the client not yet forming a complete frame
+    QByteArray mCreditBuffer;
+
+    // Single producer/single consumer ring for large frames, client only reads it.
+    // Space is released when the client grants credits for the frame.
+    QSharedMemory mRing;
+    int mRingSize;
+    int mRingWritePos;
+    int mRingUsed;
+
     TinySqlApiServer &mServer;
 
     // List of primary keys/ids which the receiving client
-    // has subscribed for
-    QList<QVariant> mSubscribedItemKeys;
+    // has subscribed for, by database and table (see notificationScope())
+    QHash<QString, QList<QVariant> > mSubscribedItemKeys;
 
     int mClientId;
     QString mSocketServerName;
 
-    bool mSending;
+    bool mConnected;
     int mError;
 
     #ifdef UNITTEST
@@ -1,14 +1,29 @@
 // Includes
 #include "sqliteapiresponsemsg.h"
+#include "tinysqliterowcodec.h"
 #include "logging.h"
 
-TinySqlApiResponseMsg::TinySqlApiResponseMsg(QObject *parent, ServerRequestType request, QSqlQuery &query, int id, const QVariant &itemKey ) :
-    QObject(parent), mRequest(request), mSqlQuery(query), mId(id), mItemKey(itemKey)
+#include <QSqlField>
+
+TinySqlApiResponseMsg::TinySqlApiResponseMsg(QObject *parent, ServerRequestType request, QSqlQuery &query, int id, int seq, const QVariant &itemKey ) :
+    QObject(parent), mRequest(request), mSqlQuery(query), mId(id), mSeq(seq), mItemKey(itemKey)
 {
     mCol = 0;
+    mRowsStarted = false;
+    mOnRow = false;
+    mSchemaRead = false;
+    mBatchEncoded = false;
+    mStorage = NULL;
+    mResultId = 0;
+    mRowsWritten = 0;
+    mRowDelta = 0;
+    mRowDeltaExact = true;
+    mDeadline = 0;
+    mCacheGeneration = 0;
 
     if(mSqlQuery.lastError().isValid()) {
         mSqlError = mSqlQuery.lastError().type();
+        mSqlErrorStr = mSqlQuery.lastError().text();
     }
     else {
         mSqlError = QSqlError::NoError;
@@ -78,3 +93,47 @@ bool TinySqlApiResponseMsg::nextCol()
     }
     return true;
 }
+
+bool TinySqlApiResponseMsg::isRowResult() const
+{
+    switch( mRequest ) {
+    case ReadGenItemReq:
+    case ReadAllGenItemsReq:
+    case CountReq:
+    case ReadTablesReq:
+    case ReadColumnsReq:
+    case ReadIndexesReq:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Moves to the first row on the first call.
+ * Returns true while positioned on a row, nextRow() moves forward.
+ */
+bool TinySqlApiResponseMsg::hasRow()
+{
+    if( !mRowsStarted ) {
+        mRowsStarted = true;
+        mOnRow = mSqlQuery.next();
+    }
+    return mOnRow;
+}
+
+/*
+ * Column types of the result, read from the query record on the first call.
+ */
+const QByteArray &TinySqlApiResponseMsg::schema()
+{
+    if( !mSchemaRead ) {
+        mSchemaRead = true;
+        QSqlRecord record = mSqlQuery.record();
+        mSchema.resize(record.count());
+        for( int col=0; col<record.count(); col++ ) {
+            mSchema[col] = char(TinySqlApiRowCodec::columnType(record.field(col).type()));
+        }
+    }
+    return mSchema;
+}
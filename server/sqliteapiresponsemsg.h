@@ -8,13 +8,15 @@
 #include <QVariant>
 #include "tinysqliteapidefs.h"
 
+class TinySqlApiStorage;
+
 class TinySqlApiResponseMsg : public QObject
 {
     Q_OBJECT
 
 public:
     //! Constructs new TinySqlApiResponseMsg
-    explicit TinySqlApiResponseMsg(QObject *parent, ServerRequestType request, QSqlQuery &query, int id, const QVariant &itemKey );
+    explicit TinySqlApiResponseMsg(QObject *parent, ServerRequestType request, QSqlQuery &query, int id, int seq, const QVariant &itemKey );
 
     //! Destructor    
     virtual ~TinySqlApiResponseMsg();
@@ -27,22 +29,101 @@ public:
     bool getNextValue( QString &value );
     bool getNextValue( QVariant &value );
     inline int id() const { return mId; }
+    // Sequence number of the request, echoed to the client in the response
+    inline int seq() const { return mSeq; }
     inline int request() const { return mRequest; }
     inline QSqlError::ErrorType queryError() const { return mSqlError; }
-    inline QString queryErrorStr() const { return mSqlQuery.lastError().text(); }
+    inline QString queryErrorStr() const { return mSqlErrorStr; }
     inline void setError(QSqlError::ErrorType error)  { mSqlError = error; }
+    inline void setError(QSqlError::ErrorType error, const QString &text)  { mSqlError = error; mSqlErrorStr = text; }
     // SQL primary key for the response item/row
     inline QVariant itemKey() const { return mItemKey; }
     bool nextCol();
 
+    // Results with rows are sent in batch frames, the query stays open until all the rows are sent
+    bool isRowResult() const;
+
+    // Storage owning the response, the query can be used only in its thread
+    inline TinySqlApiStorage *storage() const { return mStorage; }
+    inline void setStorage(TinySqlApiStorage *storage) { mStorage = storage; }
+
+    // Identifier of the open result, unique in the process and never reused.
+    // The response may be deleted by the storage, other threads refer to it by this.
+    inline int resultId() const { return mResultId; }
+    inline void setResultId(int resultId) { mResultId = resultId; }
+
+    // Cached statement the query was executed with, empty if not cached
+    inline QString statement() const { return mStatement; }
+    inline void setStatement(const QString &statement) { mStatement = statement; }
+    inline QSqlQuery &query() { return mSqlQuery; }
+
+    // Result of a multi-row write: count of rows written and indexes of the failed rows
+    inline int rowsWritten() const { return mRowsWritten; }
+    inline QList<int> failedRows() const { return mFailedRows; }
+    inline void setRowsWritten(int rows, const QList<int> &failedRows) { mRowsWritten = rows; mFailedRows = failedRows; }
+
+    // Change of the row count of the table by a committed write, not exact if it is unknown
+    inline int rowDelta() const { return mRowDelta; }
+    inline bool isRowDeltaExact() const { return mRowDeltaExact; }
+    inline void setRowDelta(int delta, bool exact = true) { mRowDelta = delta; mRowDeltaExact = exact; }
+
+    // Deadline of the request in ms since epoch, 0 for none. Checked before each batch of rows.
+    inline qint64 deadline() const { return mDeadline; }
+    inline void setDeadline(qint64 deadline) { mDeadline = deadline; }
+
+    // Row cache entry the request reads or invalidates, generation is taken before the read.
+    // Column is the primary key the request is keyed by, empty if it is not keyed by it.
+    inline QString cacheTable() const { return mCacheTable; }
+    inline QString cacheColumn() const { return mCacheColumn; }
+    inline QVariant cacheKey() const { return mCacheKey; }
+    inline quint64 cacheGeneration() const { return mCacheGeneration; }
+    inline void setCacheKey(const QString &table, const QString &column, const QVariant &key, quint64 generation)
+        { mCacheTable = table; mCacheColumn = column; mCacheKey = key; mCacheGeneration = generation; }
+
+    // Row-wise reading, used for the batched results
+    bool hasRow();
+    inline void nextRow() { mOnRow = mSqlQuery.next(); }
+    inline QVariant value(int col) const { return mSqlQuery.value(col); }
+
+    // Column types of the result in TinySqlApiRowCodec format
+    const QByteArray &schema();
+    inline bool isFirstBatch() const { return !mBatchEncoded; }
+    inline void setBatchEncoded() { mBatchEncoded = true; }
+
 private:
     ServerRequestType mRequest;
     QSqlQuery mSqlQuery;
     int mId;
+    int mSeq;
     int mCol;
 
     QVariant mItemKey;
     QSqlError::ErrorType mSqlError;
+    // Copied when constructed, the query is not used outside of the executor thread
+    QString mSqlErrorStr;
+
+    // Row-wise reading state
+    bool mRowsStarted;
+    bool mOnRow;
+
+    QByteArray mSchema;
+    bool mSchemaRead;
+    bool mBatchEncoded;
+
+    TinySqlApiStorage *mStorage;
+    int mResultId;
+    QString mStatement;
+
+    int mRowsWritten;
+    int mRowDelta;
+    bool mRowDeltaExact;
+    qint64 mDeadline;
+
+    QString mCacheTable;
+    QString mCacheColumn;
+    QVariant mCacheKey;
+    quint64 mCacheGeneration;
+    QList<int> mFailedRows;
 
     #ifdef UNITTEST
         friend class UT_TinySqlApiResponseMsg;
@@ -0,0 +1,121 @@
+// Includes
+#include "sqliteapiserverdefs.h"
+#include "sqliteapirowcache.h"
+#include "logging.h"
+
+#include <QMutexLocker>
+#include <QRegExp>
+#include <QStringList>
+
+TinySqlApiRowCache::TinySqlApiRowCache()
+{
+    mEpoch = 0;
+    mHits = 0;
+    mMisses = 0;
+    mRows.setMaxCost(TinySqlApiServerDefs::TinySqlApiRowCacheBytes);
+}
+
+void TinySqlApiRowCache::setMaxBytes(int bytes)
+{
+    QMutexLocker locker(&mMutex);
+    mRows.setMaxCost(qMax(0, bytes));
+}
+
+/*
+ * Grows whenever the table or the whole cache is invalidated,
+ * the sum of the two counters never repeats.
+ */
+quint64 TinySqlApiRowCache::generation(const QString &table) const
+{
+    QMutexLocker locker(&mMutex);
+    return mEpoch + mTableGenerations.value(table);
+}
+
+bool TinySqlApiRowCache::find(const QString &table, const QString &column, const QVariant &key,
+                              QByteArray &schema, int &rows, QByteArray &data)
+{
+    QMutexLocker locker(&mMutex);
+    if( mRows.maxCost() == 0 ) {
+        return false;
+    }
+    Entry *entry = mRows.object(cacheKey(table, column, key));
+    if( !entry ) {
+        mMisses++;
+        return false;
+    }
+    mHits++;
+    schema = entry->schema;
+    rows = entry->rows;
+    data = entry->data;
+    DPRINT << "SQLITEAPISRV:row cache hit, hits:" << mHits << "misses:" << mMisses;
+    return true;
+}
+
+void TinySqlApiRowCache::insert(const QString &table, const QString &column, const QVariant &key, quint64 generation,
+                                const QByteArray &schema, int rows, const QByteArray &data)
+{
+    QMutexLocker locker(&mMutex);
+    if( mRows.maxCost() == 0 || generation != mEpoch + mTableGenerations.value(table) ) {
+        // Written after the read started, the rows may be old
+        return;
+    }
+    QString rowKey = cacheKey(table, column, key);
+    Entry *entry = new Entry;
+    Q_CHECK_PTR(entry);
+    entry->schema = schema;
+    entry->rows = rows;
+    entry->data = data;
+    // Cost is the memory used, entry larger than the budget is not kept
+    mRows.insert(rowKey, entry, rowKey.size() * int(sizeof(QChar)) + schema.size() + data.size());
+}
+
+void TinySqlApiRowCache::invalidate(const QString &table, const QString &column, const QVariant &key)
+{
+    QMutexLocker locker(&mMutex);
+    mTableGenerations[table]++;
+    mRows.remove(cacheKey(table, column, key));
+}
+
+void TinySqlApiRowCache::invalidateTable(const QString &table)
+{
+    QMutexLocker locker(&mMutex);
+    mTableGenerations[table]++;
+    QString prefix = table + QChar('\n');
+    foreach (const QString &rowKey, mRows.keys()) {
+        if( rowKey.startsWith(prefix) ) {
+            mRows.remove(rowKey);
+        }
+    }
+}
+
+void TinySqlApiRowCache::clear()
+{
+    QMutexLocker locker(&mMutex);
+    mEpoch++;
+    mRows.clear();
+}
+
+QString TinySqlApiRowCache::tableOf(const QString &statement)
+{
+    QRegExp table("\\b(?:FROM|INTO|TABLE)\\s+([^\\s(;]+)", Qt::CaseInsensitive);
+    if( table.indexIn(statement) < 0 ) {
+        return QString();
+    }
+    return table.cap(1).toLower();
+}
+
+QString TinySqlApiRowCache::keyColumnOf(const QString &statement)
+{
+    QRegExp keyed("\\s*(?:SELECT\\s+\\*\\s+FROM|DELETE\\s+FROM)\\s+[^\\s(;]+\\s+WHERE\\s+(\\w+)\\s*=\\s*\\?\\s*;?\\s*",
+                  Qt::CaseInsensitive);
+    if( !keyed.exactMatch(statement) ) {
+        return QString();
+    }
+    return keyed.cap(1).toLower();
+}
+
+QString TinySqlApiRowCache::cacheKey(const QString &table, const QString &column, const QVariant &key)
+{
+    // Integer and text forms of the same key refer to the same row
+    return table + QChar('\n') + column + QChar('\n') + key.toString();
+}
@@ -0,0 +1,84 @@
+#ifndef SQLITEAPIROWCACHE_H_
+#define SQLITEAPIROWCACHE_H_
+
+#include <QByteArray>
+#include <QCache>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QVariant>
+
+/*
+ * Cache of the primary key reads of one database, keyed by table, primary
+ * key column and key. Only the reads of one row by the real primary key of
+ * the table are kept, writes keyed by it invalidate the row and other
+ * writes the whole table. Table and column names are lower case, like
+ * SQLite compares them. Rows are kept encoded in TinySqlApiRowCodec format, a hit is sent
+ * without SQLite. Least recently used rows are dropped first when the
+ * byte budget is full.
+ * Filled in the SQL executor threads and read and invalidated in the
+ * I/O thread. Fill is dropped if the table was written meanwhile, the
+ * generation of the table tells that.
+ */
+class TinySqlApiRowCache
+{
+public:
+    //! Construct new TinySqlApiRowCache
+    TinySqlApiRowCache();
+
+public:
+    // Byte budget, 0 disables the cache
+    void setMaxBytes(int bytes);
+
+    // Taken before the read is executed, given back on insert
+    quint64 generation(const QString &table) const;
+
+    bool find(const QString &table, const QString &column, const QVariant &key,
+              QByteArray &schema, int &rows, QByteArray &data);
+    void insert(const QString &table, const QString &column, const QVariant &key, quint64 generation,
+                const QByteArray &schema, int rows, const QByteArray &data);
+
+    // Called when the write is committed
+    void invalidate(const QString &table, const QString &column, const QVariant &key);
+    void invalidateTable(const QString &table);
+    void clear();
+
+    // Lookups by find(), reported in the stats of the database
+    inline int hits() const { return mHits; }
+    inline int misses() const { return mMisses; }
+
+    // Table the statement reads or writes in lower case, empty if not found
+    static QString tableOf(const QString &statement);
+
+    // Column of the "WHERE column = ?" term of a single-key read or delete
+    // in lower case, empty for other statements
+    static QString keyColumnOf(const QString &statement);
+
+private:
+    Q_DISABLE_COPY(TinySqlApiRowCache)
+
+    static QString cacheKey(const QString &table, const QString &column, const QVariant &key);
+
+    struct Entry
+    {
+        QByteArray schema;
+        int rows;
+        QByteArray data;
+    };
+
+    mutable QMutex mMutex;
+    QCache<QString, Entry> mRows;
+
+    // Write count per table and for the whole cache
+    QHash<QString, quint64> mTableGenerations;
+    quint64 mEpoch;
+
+    int mHits;
+    int mMisses;
+
+#ifdef UNITTEST
+    friend class UT_TinySqlApiRowCache;
+#endif
+};
+
+#endif /* SQLITEAPIROWCACHE_H_ */
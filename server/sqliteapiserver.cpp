@@ -1,13 +1,21 @@
 // Includes
+#include "sqliteapiserverdefs.h"
 #include "sqliteapiserver.h"
 #include "sqliteapirequesthandler.h"
 #include "sqliteapiresponsehandler.h"
 #include "sqliteapirequestmsg.h"
 #include "sqliteapiresponsemsg.h"
 #include "sqliteapistorage.h"
+#include "sqliteapidatabase.h"
+#include "sqliteapirowcache.h"
+#include "sqliteapiindexadvisor.h"
+#include "tinysqliterowcodec.h"
 #include "logging.h"
 
 #include <QDataStream>
+#include <QMetaType>
+#include <QDateTime>
+#include <QTimer>
 
 TinySqlApiServer::~TinySqlApiServer()
 {
@@ -16,16 +24,13 @@ TinySqlApiServer::~TinySqlApiServer()
     DPRINT << "SQLITEAPISRV:Deleting responsehandlers";
 
     disconnect(mRequestHandler, SIGNAL(newRequest(TinySqlApiRequestMsg *)), this, SLOT(handleRequest(TinySqlApiRequestMsg *)));    
-    disconnect(mStorageHandler, SIGNAL(newResponse(TinySqlApiResponseMsg *)), this, SLOT(handleResponse(TinySqlApiResponseMsg *)));
     
     qDeleteAll(mResponseHandlers.begin(), mResponseHandlers.end());
     mResponseHandlers.clear();
-    
-    qDeleteAll(mRequestQueue.begin(), mRequestQueue.end());
-    mRequestQueue.clear();
 
-    delete mStorageHandler;
-    mStorageHandler = NULL;
+    // Databases wait for their executor threads to finish
+    qDeleteAll(mDatabases.begin(), mDatabases.end());
+    mDatabases.clear();
     delete mRequestHandler;
     mRequestHandler = NULL;
 
@@ -33,23 +38,33 @@ TinySqlApiServer::~TinySqlApiServer()
 }
 
 TinySqlApiServer::TinySqlApiServer(QObject *parent) :
-    QObject(parent)
+    QObject(parent), mBatchBytes(TinySqlApiServerDefs::TinySqlApiDefaultBatchBytes),
+    mRingBytes(TinySqlApiServerDefs::TinySqlApiDefaultRingBytes),
+    mQueryTimeout(TinySqlApiServerDefs::TinySqlApiDefaultQueryTimeoutMs),
+    mGroupMaxWrites(TinySqlApiServerDefs::TinySqlApiGroupCommitMaxWrites),
+    mGroupWindowMs(TinySqlApiServerDefs::TinySqlApiGroupCommitWindowMs),
+    mRowCacheBytes(TinySqlApiServerDefs::TinySqlApiRowCacheBytes),
+    mAutoIndex(TinySqlApiServerDefs::TinySqlApiAutoIndex)
 {
-    // Create the SQL thread here
-    mStorageHandler = new TinySqlApiStorage( 0, *this );
-    Q_CHECK_PTR(mStorageHandler);
+    mDatabaseCount = 0;
+    qRegisterMetaType<TinySqlApiResponseMsg *>("TinySqlApiResponseMsg*");
+
+    mCloseTimer = new QTimer(this);
+    Q_CHECK_PTR(mCloseTimer);
+    mCloseTimer->setInterval(TinySqlApiServerDefs::TinySqlApiDatabaseIdleCloseMs);
+    connect(mCloseTimer, SIGNAL(timeout()), this, SLOT(closeIdleDatabases()));
+
     mRequestHandler = new TinySqlApiRequestHandler(0);
     Q_CHECK_PTR(mRequestHandler);
     
     connect(mRequestHandler, SIGNAL(newRequest(TinySqlApiRequestMsg *)), this, SLOT(handleRequest(TinySqlApiRequestMsg *)));    
-    connect(mStorageHandler, SIGNAL(newResponse(TinySqlApiResponseMsg *)), this, SLOT(handleResponse(TinySqlApiResponseMsg *)));
-
     connect(mRequestHandler, SIGNAL(abnormalDisconnection()), this, SLOT(abnormalServerExit()) );
 }
 
 bool TinySqlApiServer::start( int firstClientId )
 {
-    if( !mStorageHandler->initialize() ) {
+    // Default database is opened right away, the others on their first use
+    if( !database(TinySqlApiServerDefs::TinySqlApiDefaultDatabase) ) {
         DPRINT << "SQLITEAPISRV:ERR, Storage initialize failed";
         Q_ASSERT(false);
         return false;
@@ -65,16 +80,6 @@ bool TinySqlApiServer::start( int firstClientId )
     return true;
 }
 
-TinySqlApiRequestMsg *TinySqlApiServer::getNextRequest()
-{
-    DPRINT << "SQLITEAPISRV:getNextRequest(). Queue count:" << mRequestQueue.count();
-    if( mRequestQueue.count() == 0 ) {
-        DPRINT << "SQLITEAPISRV:ERR, request queue is empty";
-        return NULL;
-    }
-    return mRequestQueue.dequeue();
-}
-
 void TinySqlApiServer::addClientId(int id)
 {
     DPRINT << "SQLITEAPISRV:addClientId:" << id;
@@ -109,6 +114,9 @@ void TinySqlApiServer::removeClientId(int id)
     }
     else {
         DPRINT << "SQLITEAPISRV: client id:" << id << "removed";
+        foreach (TinySqlApiDatabase *db, mDatabases) {
+            db->removeClient(id);
+        }
         mResponseHandlers.take(id)->deleteLater();
         if( mResponseHandlers.count()==0) {
             DPRINT << "SQLITEAPISRV:No more registered clients, closing server..";
@@ -117,15 +125,25 @@ void TinySqlApiServer::removeClientId(int id)
     }
 }
 
-void TinySqlApiServer::changeSubscription(int id, const QVariant& itemKey, bool enable)
+/*
+ * Subscriptions and notifications concern one table of one database.
+ * SQLite table names are not case sensitive.
+ */
+QString TinySqlApiServer::notificationScope(const QString &database, const QString &table)
+{
+    QString dbName = database.isEmpty() ? TinySqlApiServerDefs::TinySqlApiDefaultDatabase : database;
+    return dbName + QLatin1Char('\n') + table.toLower();
+}
+
+void TinySqlApiServer::changeSubscription(int id, const QString &scope, const QVariant& itemKey, bool enable)
 {
     QHash<int, TinySqlApiResponseHandler *>::const_iterator i = mResponseHandlers.find(id);
     if(i != mResponseHandlers.end() && i.key() == id) {
         if( enable ) {
-            mResponseHandlers[id]->subscribeForNotifications(itemKey);
+            mResponseHandlers[id]->subscribeForNotifications(scope, itemKey);
         }
         else{
-            if( !mResponseHandlers[id]->removeSubscription(itemKey) ) {
+            if( !mResponseHandlers[id]->removeSubscription(scope, itemKey) ) {
                 DPRINT << "SQLITEAPISRV:ERR, changeSubscription: key not found:" << itemKey;
             }
         }
@@ -135,6 +153,56 @@ void TinySqlApiServer::changeSubscription(int id, const QVariant& itemKey, bool
     }
 }
 
+/*
+ * Returns the open database, it is opened if this is the first request
+ * to it. Empty name is the default database. NULL if it can not be opened.
+ */
+TinySqlApiDatabase *TinySqlApiServer::database(const QString &name)
+{
+    QString dbName = name.isEmpty() ? TinySqlApiServerDefs::TinySqlApiDefaultDatabase : name;
+    TinySqlApiDatabase *db = mDatabases.value(dbName);
+    if( db ) {
+        return db;
+    }
+
+    db = new TinySqlApiDatabase(0, *this, dbName, mDatabaseCount++);
+    Q_CHECK_PTR(db);
+    if( !db->open() ) {
+        delete db;
+        return NULL;
+    }
+    db->setGroupCommit(mGroupMaxWrites, mGroupWindowMs);
+    db->rowCache().setMaxBytes(mRowCacheBytes);
+    db->setAutoIndex(mAutoIndex);
+    mDatabases.insert(dbName, db);
+    DPRINT << "SQLITEAPISRV:Database" << dbName << "opened, open databases:" << mDatabases.count();
+    if( mDatabases.count() > 1 && !mCloseTimer->isActive() ) {
+        mCloseTimer->start();
+    }
+    return db;
+}
+
+/*
+ * Database is deleted only when nothing refers to its storages anymore.
+ * Clients using it are not told, their next request opens it again.
+ */
+void TinySqlApiServer::closeIdleDatabases()
+{
+    QMutableHashIterator<QString, TinySqlApiDatabase *> i(mDatabases);
+    while( i.hasNext() ) {
+        i.next();
+        if( i.key() != TinySqlApiServerDefs::TinySqlApiDefaultDatabase &&
+            i.value()->isIdle(TinySqlApiServerDefs::TinySqlApiDatabaseIdleCloseMs) ) {
+            DPRINT << "SQLITEAPISRV:closing idle database:" << i.key();
+            delete i.value();
+            i.remove();
+        }
+    }
+    if( mDatabases.count() <= 1 ) {
+        mCloseTimer->stop();
+    }
+}
+
 TinySqlApiResponseHandler* TinySqlApiServer::handler(int id) const
 {
     QHash<int, TinySqlApiResponseHandler *>::const_iterator i = mResponseHandlers.find(id);
@@ -144,21 +212,94 @@ TinySqlApiResponseHandler* TinySqlApiServer::handler(int id) const
     return NULL;
 }
 
-// Used in CancelLastReq
-void TinySqlApiServer::removeLastRequest(int id)
+// Used in CancelReq. Cancels the given request of the client:
+// removes it from the queues, interrupts it if it is running or drops
+// the rest of its result if the rows are being sent.
+void TinySqlApiServer::cancelRequest(int id, int seq)
 {
-    if(mRequestQueue.count()==0) {
-        DPRINT << "SQLITEAPISRV:ERR, removeLastRequest: no requests found";
-        return;
-    }
-    for( int i=mRequestQueue.count()-1; i>0; i-- ) {
-        if(mRequestQueue.at(i)->id() == id) {
-            mRequestQueue.removeAt(i);
-            DPRINT << "SQLITEAPISRV:Removed request for client id:" << id;
+    foreach (TinySqlApiDatabase *db, mDatabases) {
+        if( db->removeRequest(id, seq) ) {
+            DPRINT << "SQLITEAPISRV:Removed request" << seq << "for client id:" << id;
+            sendCancelResponse(id, seq);
             return;
         }
+        // Read is responded by the storage with the interrupted error,
+        // write runs to completion and is responded as usual
+        if( db->abortRunning(id, seq) ) {
+            DPRINT << "SQLITEAPISRV:Interrupted request" << seq << "for client id:" << id;
+            return;
+        }
+    }
+
+    TinySqlApiResponseHandler *responseHandler = handler(id);
+    if( responseHandler && responseHandler->cancelScan(seq) ) {
+        DPRINT << "SQLITEAPISRV:Cancelled result of request" << seq << "for client id:" << id;
+        return;
+    }
+    // Already responded, or the response is on its way from the executor thread
+    DPRINT << "SQLITEAPISRV:ERR, cancelRequest: request" << seq << "not found for client id:" << id;
+}
+
+/*
+ * Statements followed by the index advisor, one row each:
+ * statement, executions, query plan, suggested index, created.
+ * Last row with an empty statement is the row cache: lookups and
+ * the hits and misses in place of the plan.
+ */
+void TinySqlApiServer::sendStats(const TinySqlApiRequestMsg &msg, TinySqlApiDatabase &db)
+{
+    TinySqlApiResponseHandler *responseHandler = handler(msg.id());
+    if( !responseHandler ) {
+        return;
+    }
+    QByteArray schema;
+    schema.append(char(TinySqlApiRowCodec::TextColumn));
+    schema.append(char(TinySqlApiRowCodec::IntegerColumn));
+    schema.append(char(TinySqlApiRowCodec::TextColumn));
+    schema.append(char(TinySqlApiRowCodec::TextColumn));
+    schema.append(char(TinySqlApiRowCodec::IntegerColumn));
+
+    QList< QList<QVariant> > stats = db.indexAdvisor().stats();
+    TinySqlApiRowCache &rowCache = db.rowCache();
+    QList<QVariant> cacheRow;
+    cacheRow << QString() << rowCache.hits() + rowCache.misses()
+             << QString("row cache hits: %1, misses: %2").arg(rowCache.hits()).arg(rowCache.misses())
+             << QString() << 0;
+    stats.append(cacheRow);
+    QByteArray data;
+    foreach (const QList<QVariant> &row, stats) {
+        TinySqlApiRowCodec::appendRow(data, schema, row);
+    }
+    QByteArray block;
+    encodeRows(msg.seq(), StatsRes, schema, stats.count(), data, block);
+    responseHandler->sendData(block);
+}
+
+/*
+ * Sets the automatic creation of the suggested indexes.
+ */
+void TinySqlApiServer::setAutoIndex(bool enabled)
+{
+    mAutoIndex = enabled;
+    foreach (TinySqlApiDatabase *db, mDatabases) {
+        db->setAutoIndex(enabled);
+    }
+}
+
+// Completes the removed request in the client
+void TinySqlApiServer::sendCancelResponse(int id, int seq)
+{
+    TinySqlApiResponseHandler *responseHandler = handler(id);
+    if( responseHandler ) {
+        QByteArray block;
+        QDataStream out(&block, QIODevice::WriteOnly);
+        out.setVersion(int(QDataStream::Qt_4_0));
+
+        out << int(CancelRes);
+        out << seq;
+        out << int(CancelledError);
+        responseHandler->sendData(block);
     }
-    DPRINT << "SQLITEAPISRV:ERR, removeLastRequest: request for client id not found:" << id;
 }
 
 void TinySqlApiServer::handleRequest(TinySqlApiRequestMsg* msg)
@@ -180,40 +321,54 @@ void TinySqlApiServer::handleRequest(TinySqlApiRequestMsg* msg)
         removeClientId(msg->id());
         break;
 
+    // Table of the subscribed item is the message
     case SubscribeNotificationsReq:
         DPRINT << "SQLITEAPISRV:SubscribeNotificationsReq";
-        changeSubscription(msg->id(), msg->itemKey(), true);
+        changeSubscription(msg->id(), notificationScope(msg->database(), msg->request()), msg->itemKey(), true);
         sendPlainResponse(*msg);
         delete msg;
         break;
 
     case UnsubscribeNotificationsReq:
         DPRINT << "SQLITEAPISRV:UnsubscribeNotificationsReq";
-        changeSubscription(msg->id(), msg->itemKey(), false);
+        changeSubscription(msg->id(), notificationScope(msg->database(), msg->request()), msg->itemKey(), false);
         sendPlainResponse(*msg);
         delete msg;
         break;
 
-    case CancelLastReq:
-        DPRINT << "SQLITEAPISRV:CancelLastReq";
-        removeLastRequest(msg->id());
+    // Sequence number of the request to cancel is in the item key
+    case CancelReq:
+        DPRINT << "SQLITEAPISRV:CancelReq";
+        cancelRequest(msg->id(), msg->itemKey().toInt());
         sendPlainResponse(*msg);
         delete msg;
         break;
 
+    case StatsReq: {
+        // Answered by the index advisor of the client's database, SQLite is not used
+        DPRINT << "SQLITEAPISRV:StatsReq";
+        TinySqlApiDatabase *db = database(msg->database());
+        if( db ) {
+            sendStats(*msg, *db);
+        }
+        else {
+            sendErrorResponse(*msg, DatabaseError);
+        }
+        delete msg;
+        break;
+    }
+
     case ChangeDBReq:
-        DPRINT << "dbname:" << msg->itemKey().toString();
-        qDeleteAll(mRequestQueue.begin(), mRequestQueue.end());
-        mRequestQueue.clear();
-        delete mStorageHandler;
-        mStorageHandler = new TinySqlApiStorage( 0, *this );
-        Q_CHECK_PTR(mStorageHandler);
-        connect(mStorageHandler, SIGNAL(newResponse(TinySqlApiResponseMsg *)), this, SLOT(handleResponse(TinySqlApiResponseMsg *)));
-        if (!mStorageHandler->initialize(msg->itemKey().toString())) {
-            DPRINT << "SQLITEAPISRV:ERR, Storage re-initialize failed";
-            Q_ASSERT(false);
+        // Only opens the database, the client sends its next requests to it.
+        // Other clients and other open databases are not affected.
+        DPRINT << "dbname:" << msg->database();
+        if( !database(msg->database()) ) {
+            DPRINT << "SQLITEAPISRV:ERR, database can not be opened:" << msg->database();
+            sendErrorResponse(*msg, DatabaseError);
+        }
+        else {
+            sendPlainResponse(*msg);
         }
-        sendPlainResponse(*msg);
         delete msg;
         break;
 
@@ -226,15 +381,49 @@ void TinySqlApiServer::handleRequest(TinySqlApiRequestMsg* msg)
             return;
         }
 
-        // Execution of SQL queries happens only after client has been disconnected.
-        // This ensures that socket is reserved minimum of time (request socket is not reserved
-        // during SQL execution)
-        
-        // Use queue for the requests, because there may come another request before the disconnection.
-        // After client is disconnected (handleDisconnect signal) we can process the request        
-        DPRINT << "SQLITEAPISRV:enqueue request(). Queue count before:" << mRequestQueue.count();
-        mRequestQueue.enqueue(msg);
-        emit newRequest();
+        TinySqlApiDatabase *db = database(msg->database());
+        if( !db ) {
+            DPRINT << "SQLITEAPISRV:ERR, database can not be opened:" << msg->database() << ". Request is ignored.";
+            sendErrorResponse(*msg, DatabaseError);
+            delete msg;
+            break;
+        }
+
+        if( msg->deadline() == 0 && mQueryTimeout > 0 ) {
+            msg->setDeadline(QDateTime::currentMSecsSinceEpoch() + mQueryTimeout);
+        }
+
+        // Hot primary key reads are answered from the row cache without SQLite
+        {
+            QByteArray schema;
+            QByteArray data;
+            int rows = 0;
+            if( db->readCached(*msg, schema, rows, data) ) {
+                QByteArray block;
+                encodeRows(msg->seq(), ItemDataRes, schema, rows, data, block);
+                handler(msg->id())->sendData(block);
+                delete msg;
+                break;
+            }
+
+            // Row count of the table is kept by the database, the table is not scanned
+            int count = 0;
+            if( db->countCached(*msg, count) ) {
+                schema = QByteArray(1, char(TinySqlApiRowCodec::IntegerColumn));
+                TinySqlApiRowCodec::appendRow(data, schema, QVariantList() << count);
+                QByteArray block;
+                encodeRows(msg->seq(), CountRes, schema, 1, data, block);
+                handler(msg->id())->sendData(block);
+                delete msg;
+                break;
+            }
+        }
+
+        // Request is read from the client's persistent connection, it is processed
+        // right away without waiting for the client to disconnect.
+        // Use queue for the requests, because there may come another request before the
+        // previous one has been executed.
+        db->enqueueRequest(msg);
         break;
     }
 
@@ -261,6 +450,7 @@ void TinySqlApiServer::sendPlainResponse(const TinySqlApiRequestMsg& msg)
         out.setVersion(int(QDataStream::Qt_4_0));
 
         out << int(ConfirmationRes);
+        out << msg.seq();
 
         DPRINT << "SQLITEAPISRV:Sending response to client id:" << msg.id();
         responseHandler->sendData(block);
@@ -271,8 +461,108 @@ void TinySqlApiServer::sendPlainResponse(const TinySqlApiRequestMsg& msg)
     }
 }
 
+/*
+ * Response of the request's own type carrying the error, for the requests
+ * that are not executed. Results with rows end without any rows.
+ * Failed change of the database is told as a failed initialization.
+ */
+void TinySqlApiServer::sendErrorResponse(const TinySqlApiRequestMsg& msg, TinySqlApiServerError error)
+{
+    TinySqlApiResponseHandler *responseHandler = handler(msg.id());
+    if( !responseHandler ) {
+        // Client may be removed before the request was received
+        DPRINT << "SQLITEAPISRV:ERR, Responsehandler not found for id:" << msg.id();
+        return;
+    }
+
+    ServerResponseType type = UndefinedRes;
+    bool rows = false;
+    switch( msg.type() ) {
+    case ReadGenItemReq:
+    case ReadAllGenItemsReq:
+        type = ItemDataRes;
+        rows = true;
+        break;
+    case CountReq:
+        type = CountRes;
+        rows = true;
+        break;
+    case ReadTablesReq:
+        type = TablesRes;
+        rows = true;
+        break;
+    case ReadColumnsReq:
+        type = ColumnsRes;
+        rows = true;
+        break;
+    case ReadIndexesReq:
+        type = IndexesRes;
+        rows = true;
+        break;
+    case StatsReq:
+        type = StatsRes;
+        rows = true;
+        break;
+    case CreateTableReq:
+    case ChangeDBReq:
+        type = InitializedRes;
+        break;
+    case WriteGenItemReq:
+        type = WriteGenItemRes;
+        break;
+    case WriteGenItemsReq:
+        type = WriteGenItemsRes;
+        break;
+    case DeleteReq:
+        type = DeleteRes;
+        break;
+    case DeleteAllReq:
+        type = DeleteAllRes;
+        break;
+    case BeginTransactionReq:
+    case CommitReq:
+    case RollbackReq:
+        type = TransactionRes;
+        break;
+    case CreateIndexReq:
+    case DropIndexReq:
+        type = IndexRes;
+        break;
+    default:
+        sendPlainResponse(msg);
+        return;
+    }
+
+    QByteArray block;
+    if( rows ) {
+        encodeEndOfResult(msg.seq(), type, error, block);
+    }
+    else {
+        QDataStream out(&block, QIODevice::WriteOnly);
+        out.setVersion(int(QDataStream::Qt_4_0));
+        out << int(type);
+        out << msg.seq();
+        out << error;
+        if( type == WriteGenItemsRes ) {
+            out << int(0);
+            out << QList<int>();
+        }
+    }
+    DPRINT << "SQLITEAPISRV:Sending error response to client id:" << msg.id() << ", error:" << int(error);
+    responseHandler->sendData(block);
+}
+
 void TinySqlApiServer::handleResponse(TinySqlApiResponseMsg *msg)
 {
+    TinySqlApiDatabase &db = msg->storage()->database();
+    if( !msg->storage()->isReader() ) {
+        db.writeResponded(msg->id());
+        db.updateRowCounts(*msg);
+    }
+    else {
+        db.readResponded();
+    }
+
     ServerResponseType responseType = UndefinedRes;
     ServerResponseType notificationType = UndefinedRes;
     bool sendChangeNotification = false;
@@ -288,10 +578,47 @@ void TinySqlApiServer::handleResponse(TinySqlApiResponseMsg *msg)
         responseType = ItemDataRes;
         break;
 
+    // Writes are committed when they are responded, cached rows are dropped.
+    // Rows written by a client transaction are dropped again when it is committed.
+    // Write not keyed by the primary key may change any row of the table.
     case WriteGenItemReq:
+        db.invalidateCached(*msg);
+        sendChangeNotification = true;
+        notificationType = UpdateNotification;
         responseType = WriteGenItemRes;
         break;
 
+    // Notification without the key tells that any item may have changed
+    case WriteGenItemsReq:
+        db.invalidateCached(*msg);
+        sendChangeNotification = true;
+        notificationType = UpdateNotification;
+        responseType = WriteGenItemsRes;
+        break;
+
+    case BeginTransactionReq:
+        if( queryError != QSqlError::NoError ) {
+            db.transactionFailed(msg->id(), msg->seq());
+        }
+        responseType = TransactionRes;
+        break;
+
+    // Writes of the transaction become visible to the other clients now,
+    // their notifications held meanwhile are sent after the response.
+    // Failed commit is rolled back by the writer.
+    case CommitReq:
+        if( queryError == QSqlError::NoError ) {
+            db.invalidateCommitted();
+        }
+        responseType = TransactionRes;
+        break;
+
+    // Cached rows are the committed ones, rolled back writes did not change them
+    case RollbackReq:
+        db.takeNotifications();
+        responseType = TransactionRes;
+        break;
+
     case CountReq:
         responseType = CountRes;
         break;
@@ -304,7 +631,22 @@ void TinySqlApiServer::handleResponse(TinySqlApiResponseMsg *msg)
         responseType = ColumnsRes;
         break;
 
+    // Indexes do not change the rows, cached rows and counts stay valid.
+    // Query plans may change, the statements are explained again.
+    case CreateIndexReq:
+    case DropIndexReq:
+        if( queryError == QSqlError::NoError ) {
+            db.indexAdvisor().replan();
+        }
+        responseType = IndexRes;
+        break;
+
+    case ReadIndexesReq:
+        responseType = IndexesRes;
+        break;
+
     case CreateTableReq:
+        db.invalidateCached(*msg);
         responseType = InitializedRes;
         // If the error message was "table already exists Unable to execute statement"
         // handle not as error
@@ -315,31 +657,30 @@ void TinySqlApiServer::handleResponse(TinySqlApiResponseMsg *msg)
         break;
 
     case DeleteReq:
+        db.invalidateCached(*msg);
         sendChangeNotification = true;
         notificationType = DeleteNotification;
         responseType = DeleteRes;
         break;
 
     case DeleteAllReq:
+        db.invalidateCached(*msg);
         sendChangeNotification = true;
         notificationType = DeleteNotification;
         responseType = DeleteAllRes;
         break;
 
     // For ReadAllGenItemsReq Request
-    // 1. send message with first msg, put all the next items in the response queue
-    // 2. after readyRead signal, next response is sent from the queue
-    // 3. repeats 2 until queue is empty
+    // 1. put the open result in the response queue
+    // 2. response handler encodes and sends as many batch frames as the client has granted credits for
+    // 3. client grants more credits in bulk, repeats 2 until all the rows are sent
 
     case ReadAllGenItemsReq:
         responseType = ItemDataRes;
-        if (queryError==QSqlError::NoError) {
-            enqueueItems(*msg, responseType, translatedErrorCode);
-        }
         break;
 
     // These are not handled here = no response
-    case CancelLastReq:
+    case CancelReq:
     case RegisterReq:
     case SubscribeNotificationsReq:
     case UnsubscribeNotificationsReq:
@@ -349,51 +690,59 @@ void TinySqlApiServer::handleResponse(TinySqlApiResponseMsg *msg)
         break;
     }
         
-    // Send the response
-    sendToClient(*msg, responseType, translatedErrorCode);
+    // Send the response, results with rows are sent as batch frames.
+    // Storage releases the open result after the last batch.
+    if( msg->isRowResult() ) {
+        if( enqueueItems(msg, responseType, translatedErrorCode) ) {
+            return;
+        }
+    }
+    else {
+        sendToClient(*msg, responseType, translatedErrorCode);
+    }
 
-    // Send change notification also if relevant for the type (and if operation was successful)
-    if(sendChangeNotification && (queryError==QSqlError::NoError)){
+    // Send change notification also if relevant for the type (and if operation was successful).
+    // Writes of the open client transaction are notified when it is committed.
+    if(sendChangeNotification && (queryError==QSqlError::NoError) &&
+       !db.deferNotification(notificationType, msg->cacheTable(), msg->itemKey())){
         sendToClient(*msg, notificationType, translatedErrorCode);
     }
-    delete msg;
+    if( msg->request() == CommitReq ) {
+        QList<TinySqlApiDatabase::Notification> notifications = db.takeNotifications();
+        if( queryError == QSqlError::NoError ) {
+            foreach (const TinySqlApiDatabase::Notification &notification, notifications) {
+                sendNotification(msg->id(), notificationScope(db.name(), notification.table),
+                                 notification.type, notification.key);
+            }
+        }
+    }
+    // Responses are owned by the storage, deleted in the executor thread
+    closeResult(msg->storage(), msg->resultId());
 }
 
-void TinySqlApiServer::convertToSupportedType(QDataStream &in, const QVariant &from) const
+void TinySqlApiServer::handleBatch(int clientId, int resultId, const QByteArray &block, bool more)
 {
-    QVariant converted;
-
-    switch(from.type()) {
-    case QVariant::Bool:
-    case QVariant::Int:
-    case QVariant::UInt:
-    case QVariant::String:
-    case QVariant::StringList:
-    case QVariant::Char:
-    case QVariant::Map:
-    case QVariant::List:
-    case QVariant::ByteArray:
-    case QVariant::BitArray:
-    case QVariant::Double:
-        // Handle QVariant of this type "as-it-is", no conversion
-        in << from;
-        break;
+    TinySqlApiResponseHandler *responseHandler = handler(clientId);
+    if( responseHandler ) {
+        responseHandler->batchEncoded(resultId, block, more);
+    }
+    else {
+        // Client is removed while the batch was read, result is released by the response handler
+        DPRINT << "SQLITEAPISRV:ERR, Responsehandler not found for id:" << clientId;
+    }
+}
 
-    case QVariant::LongLong:
-    case QVariant::ULongLong:
-        // Conversion needed
-        converted = from.toInt();
-        //DPRINT << "SQLITEAPISRV:Converted to Int:" << converted;
-        in << converted;
-        break;
+void TinySqlApiServer::readNextBatch(TinySqlApiStorage *storage, int resultId,
+                                     ServerResponseType type, TinySqlApiServerError error)
+{
+    QMetaObject::invokeMethod(storage, "encodeBatch", Qt::QueuedConnection,
+                              Q_ARG(int, resultId), Q_ARG(int, int(type)), Q_ARG(int, int(error)));
+}
 
-    default:
-        // Not used yet, conversion needed, QString by default
-        converted = from.toString();
-        //DPRINT << "SQLITEAPISRV:Converted to Int:" << converted;
-        in << converted;
-        break;
-    }
+void TinySqlApiServer::closeResult(TinySqlApiStorage *storage, int resultId)
+{
+    QMetaObject::invokeMethod(storage, "releaseResponse", Qt::QueuedConnection,
+                              Q_ARG(int, resultId));
 }
 
 TinySqlApiServerError TinySqlApiServer::translateSqlError(const QString &from) const
@@ -404,6 +753,12 @@ TinySqlApiServerError TinySqlApiServer::translateSqlError(const QString &from) c
     else if( from.contains("no such table", Qt::CaseInsensitive) ) {
         return NotFoundError;
     }
+    else if( from.contains(TinySqlApiServerDefs::TinySqlApiDeadlineErrorText, Qt::CaseInsensitive) ) {
+        return TimeoutError;
+    }
+    else if( from.contains("interrupted", Qt::CaseInsensitive) ) {
+        return CancelledError;
+    }
     return UndefinedError;
 }
 
@@ -413,45 +768,22 @@ void TinySqlApiServer::sendToClient(TinySqlApiResponseMsg &msg, ServerResponseTy
     QDataStream out(&block, QIODevice::WriteOnly);
     out.setVersion(int(QDataStream::Qt_4_0));
 
-    out << int(type);
-
     if( type == UpdateNotification || type == DeleteNotification ) {
-        DPRINT << "SQLITEAPISRV:Checking if there are subscribed clients to notify";
-
-        // Output the SQL primary key (identifier for the item)
-        out << msg.itemKey();
-
-        // For change notifications,
-        // loop thru all recipients, send only subscribed recipients
-        foreach (TinySqlApiResponseHandler* handler, mResponseHandlers) {            
-            // Do not send change notification for the client making the change (only inform other clients)
-            // (match msg client-id to the current responsehandler client-id)            
-            if( (handler->isSubscribedFor(msg.itemKey())) && (msg.id()!=handler->clientId()) ) {
-                DPRINT << "SQLITEAPISRV:Sending change notification to client id:" << handler->clientId();
-                DPRINT << "SQLITEAPISRV:Primary key of the changed item:" << msg.itemKey();
-                handler->sendData(block);
-            }
-        }
+        sendNotification(msg.id(), notificationScope(msg.storage()->database().name(), msg.cacheTable()),
+                         type, msg.itemKey());
     }
     else{
         // This is not a notification, but response for single client's request
+        out << int(type);
 
         DPRINT << "SQLITEAPISRV:Response type:" << int(type);
         DPRINT << "SQLITEAPISRV:Response error:" << int(error);
+        out << msg.seq();
         out << error;
 
-        QVariant value;
-
-        if(msg.startReading()>0){
-            DPRINT << "SQLITEAPISRV:row count:" << msg.columns();
-            while(msg.getNextValue(value)) {
-                // convertToSupportedType writes variant into the stream
-                DPRINT << "SQLITEAPISRV:Writing value:" << value.toString();
-                convertToSupportedType(out, value );
-            }
-        }
-        else{
-            DPRINT << "SQLITEAPISRV:No SQL values found";
+        if( type == WriteGenItemsRes ) {
+            out << msg.rowsWritten();
+            out << msg.failedRows();
         }
 
         TinySqlApiResponseHandler *responseHandler = handler(msg.id());
@@ -466,53 +798,186 @@ void TinySqlApiServer::sendToClient(TinySqlApiResponseMsg &msg, ServerResponseTy
     }
 }
 
-void TinySqlApiServer::enqueueItems(TinySqlApiResponseMsg &msg, ServerResponseType type, TinySqlApiServerError error)
+/*
+ * Change notification to the clients other than the sender subscribed to
+ * the table of the change. Notifications are not responses to any request
+ * of the receiver.
+ */
+void TinySqlApiServer::sendNotification(int senderId, const QString &scope, ServerResponseType type, const QVariant &itemKey)
 {
-    if (msg.startReading()>0){
-        DPRINT << "SQLITEAPISRV:column count:" << msg.columns();
+    QByteArray block;
+    QDataStream out(&block, QIODevice::WriteOnly);
+    out.setVersion(int(QDataStream::Qt_4_0));
 
-        TinySqlApiResponseHandler *responseHandler = handler(msg.id());
-        if (responseHandler){
+    out << int(type);
+    out << int(0);
 
-            bool bytesAvailable(true); // true until !getNextValue
+    DPRINT << "SQLITEAPISRV:Checking if there are subscribed clients to notify";
 
-            while(bytesAvailable) {
+    // Output the SQL primary key (identifier for the item),
+    // empty when the change is not limited to one item
+    QString key = itemKey.toString();
+    out << (key.isEmpty() ? QVariant(QString()) : itemKey);
 
-                QByteArray block;
-                QDataStream out(&block, QIODevice::WriteOnly);
-                out.setVersion(int(QDataStream::Qt_4_0));
-
-                out << int(type);
-                out << error;
-
-                // Read whole row
-                while (bytesAvailable) {
-                    QVariant value;
-                    bytesAvailable = msg.getNextValue(value);
-
-                    if (bytesAvailable) {
-                        // convertToSupportedType writes variant into the stream
-                        DPRINT << "SQLITEAPISRV:Writing value:" << value.toString();
-                        convertToSupportedType(out, value );
-                        // Check if column was last
-                        if (msg.column()>=msg.columns()) {
-                            DPRINT << "SQLITEAPISRV:last item in the row";
-                            break;
-                        }
-                    }
-                    else{
-                        DPRINT << "SQLITEAPISRV:last value";
-                    }
-                }
-                responseHandler->enqueueData(block);
-            }
+    // For change notifications,
+    // loop thru all recipients, send only subscribed recipients.
+    // Change of the whole table concerns every subscriber of the table.
+    foreach (TinySqlApiResponseHandler* handler, mResponseHandlers) {
+        bool subscribed = key.isEmpty() ? handler->hasSubscriptions(scope) : handler->isSubscribedFor(scope, itemKey);
+        // Do not send change notification for the client making the change (only inform other clients)
+        // (match sender client-id to the current responsehandler client-id)
+        if( subscribed && (senderId!=handler->clientId()) ) {
+            DPRINT << "SQLITEAPISRV:Sending change notification to client id:" << handler->clientId();
+            DPRINT << "SQLITEAPISRV:Primary key of the changed item:" << itemKey;
+            handler->sendData(block);
         }
-        else{
-            // Client may be removed before the request was received
-            DPRINT << "SQLITEAPISRV:ERR, Responsehandler not found for id:" << msg.id();
+    }
+}
+
+/*
+ * Hands the result over to the client's response handler, which requests
+ * the rows from the executor thread batch by batch as the client consumes them.
+ * Returns false if the client is not found, the caller releases the result then.
+ */
+bool TinySqlApiServer::enqueueItems(TinySqlApiResponseMsg *msg, ServerResponseType type, TinySqlApiServerError error)
+{
+    TinySqlApiResponseHandler *responseHandler = handler(msg->id());
+    if( !responseHandler ) {
+        // Client may be removed before the request was received
+        DPRINT << "SQLITEAPISRV:ERR, Responsehandler not found for id:" << msg->id();
+        return false;
+    }
+
+    // Rows are packed into batch frames of mBatchBytes,
+    // there is always at least one frame and the last one is marked
+    responseHandler->enqueueScan(msg, type, error);
+    responseHandler->dequeueNextResponse();
+    return true;
+}
+
+/*
+ * Called in the SQL executor thread.
+ * Writes one batch frame: response type, sequence number, error, last-flag,
+ * row count and schema (column types, only in the first frame of the result)
+ * followed by the rows in TinySqlApiRowCodec format.
+ * Rows are added until the frame reaches the byte budget.
+ * Returns true if there are rows left for the next batch.
+ */
+bool TinySqlApiServer::encodeBatch(TinySqlApiResponseMsg &msg, ServerResponseType type, TinySqlApiServerError error, QByteArray &block)
+{
+    QDataStream out(&block, QIODevice::WriteOnly);
+    out.setVersion(int(QDataStream::Qt_4_0));
+
+    out << int(type);
+    out << msg.seq();
+    out << error;
+
+    // Last-flag and row count are written again when the batch is complete
+    qint64 headerPos = out.device()->pos();
+    out << false;
+    out << int(0);
+
+    const QByteArray &schema = msg.schema();
+    bool firstBatch = msg.isFirstBatch();
+    if( firstBatch ) {
+        out << schema;
+    }
+    else {
+        out << QByteArray();
+    }
+
+    // Rows are appended directly after the header
+    int rowsPos = block.size();
+    int rows = 0;
+    while( msg.hasRow() ) {
+        TinySqlApiRowCodec::appendRow(block, schema, msg);
+        rows++;
+        msg.nextRow();
+        if( block.size() >= mBatchBytes ) {
+            break;
         }
     }
-    else{
-        DPRINT << "SQLITEAPISRV:No SQL values found";
+    msg.setBatchEncoded();
+
+    bool last = !msg.hasRow();
+    out.device()->seek(headerPos);
+    out << last;
+    out << rows;
+
+    // Result of a primary key read fits to one batch, it is kept for the next reads.
+    // Writer may see uncommitted writes, only the committed rows read by the readers are kept.
+    if( msg.request() == ReadGenItemReq && !msg.cacheColumn().isEmpty() && firstBatch && last &&
+        error == NoError && msg.storage()->isReader() ) {
+        msg.storage()->database().rowCache().insert(msg.cacheTable(), msg.cacheColumn(), msg.cacheKey(),
+                                                    msg.cacheGeneration(), schema, rows, block.mid(rowsPos));
     }
+
+    DPRINT << "SQLITEAPISRV:batch of" << rows << "row(s)," << block.size() << "bytes, last:" << last;
+    return !last;
+}
+
+/*
+ * Writes an empty last batch frame, used to end a result whose rows
+ * can not be read anymore.
+ */
+void TinySqlApiServer::encodeEndOfResult(int seq, ServerResponseType type, TinySqlApiServerError error, QByteArray &block)
+{
+    QDataStream out(&block, QIODevice::WriteOnly);
+    out.setVersion(int(QDataStream::Qt_4_0));
+
+    out << int(type);
+    out << seq;
+    out << error;
+    out << true;
+    out << int(0);
+    out << QByteArray();
+}
+
+/*
+ * Writes a complete result of one batch frame, rows are already encoded.
+ */
+void TinySqlApiServer::encodeRows(int seq, ServerResponseType type, const QByteArray &schema, int rows,
+                                  const QByteArray &data, QByteArray &block)
+{
+    QDataStream out(&block, QIODevice::WriteOnly);
+    out.setVersion(int(QDataStream::Qt_4_0));
+
+    out << int(type);
+    out << seq;
+    out << NoError;
+    out << true;
+    out << rows;
+    out << schema;
+    block.append(data);
+}
+
+/*
+ * Sets the byte budget of the row caches.
+ */
+void TinySqlApiServer::setRowCacheBytes(int bytes)
+{
+    mRowCacheBytes = qMax(0, bytes);
+    foreach (TinySqlApiDatabase *db, mDatabases) {
+        db->rowCache().setMaxBytes(mRowCacheBytes);
+    }
+}
+
+/*
+ * Sets the group commit limits of the writer.
+ */
+void TinySqlApiServer::setGroupCommit(int maxWrites, int windowMs)
+{
+    mGroupMaxWrites = maxWrites;
+    mGroupWindowMs = windowMs;
+    foreach (TinySqlApiDatabase *db, mDatabases) {
+        db->setGroupCommit(maxWrites, windowMs);
+    }
+}
+
+/*
+ * Sets the byte budget of one result batch frame.
+ */
+void TinySqlApiServer::setBatchBytes(int bytes)
+{
+    mBatchBytes = qMax(1, bytes);
 }
@@ -2,8 +2,11 @@
 #define SQLITEAPISERVER_H_
 
 #include <QQueue>
+#include <QHash>
 #include "sqliteapiresponsemsg.h"
 
+class QTimer;
+class TinySqlApiDatabase;
 class TinySqlApiRequestHandler;
 class TinySqlApiResponseHandler;
 class TinySqlApiStorage;
@@ -29,19 +32,46 @@ public:
     // Sends just the confirmation response to the last request
     // not used for SQL related requests, only for simple ones
     void sendPlainResponse(const TinySqlApiRequestMsg& msg);
-
-    // Get next request/response from the queue
-    TinySqlApiRequestMsg *getNextRequest();
+    void sendErrorResponse(const TinySqlApiRequestMsg& msg, TinySqlApiServerError error);
 
     inline int registeredCount() const { return mResponseHandlers.count(); }
 
     void removeClientId(int id);
 
+    // Byte budget for one result batch frame
+    void setBatchBytes(int bytes);
+    inline int batchBytes() const { return mBatchBytes; }
+
+    // Size of the shared memory ring created for each new client, 0 disables
+    inline void setRingBytes(int bytes) { mRingBytes = bytes; }
+    inline int ringBytes() const { return mRingBytes; }
+
+    // Deadline of the requests that do not carry one, 0 for no deadline
+    inline void setQueryTimeout(int msecs) { mQueryTimeout = qMax(0, msecs); }
+
+    // Memory budget of the row cache of each database, 0 disables
+    void setRowCacheBytes(int bytes);
+
+    // Writes within the window, up to maxWrites, are committed together. maxWrites 1 disables.
+    void setGroupCommit(int maxWrites, int windowMs);
+
+    // Indexes suggested by the index advisor are created when the database is idle
+    void setAutoIndex(bool enabled);
+
+    // Result batch frames. Rows are read in the SQL executor thread when
+    // the response handler has room to send, see readNextBatch()
+    bool encodeBatch(TinySqlApiResponseMsg &msg, ServerResponseType type, TinySqlApiServerError error, QByteArray &block);
+    void encodeEndOfResult(int seq, ServerResponseType type, TinySqlApiServerError error, QByteArray &block);
+    void encodeRows(int seq, ServerResponseType type, const QByteArray &schema, int rows,
+                    const QByteArray &data, QByteArray &block);
+
+    // Open results are owned by the storage, these are queued to its executor thread
+    void readNextBatch(TinySqlApiStorage *storage, int resultId,
+                       ServerResponseType type, TinySqlApiServerError error);
+    void closeResult(TinySqlApiStorage *storage, int resultId);
+
 signals:
 
-    // Has to be connected to storage handler's slot (handleRequest)
-    void newRequest();
-    
     // Has to be connected to response handler's response slot (handleResponse)
     void newResponse();
 
@@ -55,31 +85,62 @@ private slots:
     // Parses the response from storage handler
     void handleResponse(TinySqlApiResponseMsg *msg);
 
+    // Batch of rows read by the storage handler
+    void handleBatch(int clientId, int resultId, const QByteArray &block, bool more);
+
     void abnormalServerExit();
 
+    // Closes the databases other than the default one that are idle
+    void closeIdleDatabases();
+
 private:
 
     void addClientId(int id);
-    void changeSubscription(int id, const QVariant &itemKey, bool state);
+    TinySqlApiDatabase *database(const QString &name);
+    static QString notificationScope(const QString &database, const QString &table);
+    void changeSubscription(int id, const QString &scope, const QVariant &itemKey, bool state);
     TinySqlApiResponseHandler* handler(int id) const;
-    void removeLastRequest(int id);
-    void convertToSupportedType(QDataStream &in, const QVariant &from) const;
+    void cancelRequest(int id, int seq);
+    void sendCancelResponse(int id, int seq);
+    void sendStats(const TinySqlApiRequestMsg &msg, TinySqlApiDatabase &db);
     TinySqlApiServerError translateSqlError(const QString &from) const;
     void sendToClient(TinySqlApiResponseMsg &msg, ServerResponseType type, TinySqlApiServerError error);
-    void enqueueItems(TinySqlApiResponseMsg &msg, ServerResponseType type, TinySqlApiServerError error);
+    void sendNotification(int senderId, const QString &scope, ServerResponseType type, const QVariant &itemKey);
+    bool enqueueItems(TinySqlApiResponseMsg *msg, ServerResponseType type, TinySqlApiServerError error);
 
 private:
 
-    QQueue<TinySqlApiRequestMsg *> mRequestQueue;
-
     TinySqlApiRequestHandler *mRequestHandler;
 
     // List of registered client ids (for async responses/notifications) and
     // response handlers for relative socket
     QHash<int, TinySqlApiResponseHandler *> mResponseHandlers;
 
-    // Server owns the instance of the storage
-    TinySqlApiStorage *mStorageHandler;
+    // Open databases by file name, each with its own executors.
+    // Opened on the first request, closed when idle. Default database
+    // is kept open until the server closes.
+    QHash<QString, TinySqlApiDatabase *> mDatabases;
+    int mDatabaseCount;
+    QTimer *mCloseTimer;
+
+    // Byte budget for one result batch frame
+    int mBatchBytes;
+
+    // Size of the per-client shared memory ring
+    int mRingBytes;
+
+    // Server side deadline for the requests, 0 for no deadline
+    int mQueryTimeout;
+
+    // Group commit limits, applied also to the databases opened later
+    int mGroupMaxWrites;
+    int mGroupWindowMs;
+
+    // Row cache budget, applied also to the databases opened later
+    int mRowCacheBytes;
+
+    // Automatic index creation, applied also to the databases opened later
+    bool mAutoIndex;
 
     #ifdef UNITTEST
         friend class UT_TinySqlApiServer;
@@ -1,52 +1,534 @@
 // Includes
 #include "sqliteapiresponsemsg.h"
 #include "sqliteapisql.h"
+#include "sqliteapiserverdefs.h"
+#include "sqliteapirowcache.h"
 #include "logging.h"
 
+#include <QSqlQuery>
+#include <QSqlDriver>
+#include <QSqlResult>
+#include <QDateTime>
+#include <QRegExp>
+#include <QStringList>
+#include <sqlite3.h>
+
 TinySqlApiSql::~TinySqlApiSql()
 {
-    DPRINT << "SQLITEAPISRV:~TinySqlApiSql";
+    DPRINT << "SQLITEAPISRV:~TinySqlApiSql" << mConnectionName;
+    // Statements are finalized before the connection is closed
+    mStatements.clear();
     mDb.close();
+    mDb = QSqlDatabase();
+    QSqlDatabase::removeDatabase(mConnectionName);
+}
+
+TinySqlApiSql::TinySqlApiSql(QObject *parent, const QString &connectionName) :
+    QObject(parent), mConnectionName(connectionName)
+{
+    mStatements.setMaxCost(TinySqlApiServerDefs::TinySqlApiStatementCacheSize);
+    mInterrupts = false;
+    mInterruptible = false;
+    mAbort = 0;
+    mDeadline = 0;
+    mDeadlineExceeded = false;
 }
 
-TinySqlApiSql::TinySqlApiSql(QObject *parent) :
-    QObject(parent)
+/*
+ * SQLite progress handler, non-zero return value interrupts the running
+ * statement of this connection only. Other open results are not affected.
+ * Only read-only statements are interrupted, writes run to completion.
+ */
+int TinySqlApiSql::progress(void *sql)
 {
+    TinySqlApiSql *self = static_cast<TinySqlApiSql *>(sql);
+    if( !self->mInterruptible ) {
+        return 0;
+    }
+    if( int(self->mAbort) ) {
+        return 1;
+    }
+    if( self->mDeadline > 0 && QDateTime::currentMSecsSinceEpoch() >= self->mDeadline ) {
+        self->mDeadlineExceeded = true;
+        return 1;
+    }
+    return 0;
 }
 
 bool TinySqlApiSql::initialize(const QString &name)
 {
-    mDb = QSqlDatabase::addDatabase( "QSQLITE");
+    mDb = QSqlDatabase::addDatabase( "QSQLITE", mConnectionName);
     if(!mDb.isValid()){
         DPRINT << "SQLITEAPISRV:ERR, QSqlDatabase is not valid, error:" << mDb.lastError().text();
         return false;
     }
     mDb.setDatabaseName(name);
+    mDb.setConnectOptions(QString("QSQLITE_BUSY_TIMEOUT=%1").arg(TinySqlApiServerDefs::TinySqlApiBusyTimeoutMs));
 
     if(!mDb.open()){
         DPRINT << "SQLITEAPISRV:ERR, Unable to connect to DB, error:" << mDb.lastError().text();
         return false;
     }
+
+    // The handle can be given to the SQLite C API only if the driver uses the same
+    // library. QSQLITE plugin built with its bundled SQLite has a copy of its own,
+    // then cancel and deadline do not interrupt running statements.
+    QVariant handle = mDb.driver()->handle();
+    QSqlQuery source(mDb);
+    if( handle.isValid() && qstrcmp(handle.typeName(), "sqlite3*") == 0 &&
+        source.exec("SELECT sqlite_source_id()") && source.next() &&
+        source.value(0).toString() == QString::fromLatin1(sqlite3_sourceid()) ) {
+        sqlite3 *db = *static_cast<sqlite3 **>(handle.data());
+        if( db ) {
+            sqlite3_progress_handler(db, TinySqlApiServerDefs::TinySqlApiProgressOps, &TinySqlApiSql::progress, this);
+            mInterrupts = true;
+        }
+    }
+    if( !mInterrupts ) {
+        // Told once per process, in release builds too. Cancel and deadline still work
+        // for the queued requests and between the result batches.
+        static bool warned = false;
+        if( !warned ) {
+            warned = true;
+            qWarning("SQLITEAPISRV:ERR, QSQLITE driver does not use the linked SQLite %s, "
+                     "cancel and deadline do not interrupt running statements", sqlite3_libversion());
+        }
+    }
+
+    // In WAL mode readers do not wait for the writer and the writer does not wait for readers.
+    // The mode is stored in the database file.
+    QSqlQuery walQuery(mDb);
+    if( !walQuery.exec("PRAGMA journal_mode=WAL") ) {
+        DPRINT << "SQLITEAPISRV:ERR, WAL mode not set, error:" << walQuery.lastError().text();
+    }
     return true;
 }
 
-TinySqlApiResponseMsg *TinySqlApiSql::sqlExecute(TinySqlApiRequestMsg& msg)
+TinySqlApiResponseMsg *TinySqlApiSql::sqlExecute(TinySqlApiRequestMsg& msg, bool inTransaction)
 {
-    QString sqlQuery = msg.request();
+    if( msg.isExpired() ) {
+        return sqlExpired( msg );
+    }
+
+    // Statement running past the deadline is interrupted by the progress handler
+    mDeadline = msg.isTransactionControl() ? 0 : msg.deadline();
+    mDeadlineExceeded = false;
+
+    TinySqlApiResponseMsg *responsemsg = NULL;
+    if( msg.type() == WriteGenItemsReq ) {
+        responsemsg = sqlExecuteRows( msg, inTransaction );
+    }
+    else {
+        responsemsg = sqlExecuteQuery( msg );
+    }
+
+    // Rows of the result are read later, the deadline is checked before each batch
+    responsemsg->setDeadline(mDeadline);
+    mDeadline = 0;
+    if( mDeadlineExceeded ) {
+        DPRINT << "SQLITEAPISRV:ERR, request" << msg.seq() << "of client" << msg.id() << "interrupted at the deadline";
+        responsemsg->setError(QSqlError::StatementError, TinySqlApiServerDefs::TinySqlApiDeadlineErrorText);
+    }
+    return responsemsg;
+}
+
+/*
+ * Request whose deadline passed while it was queued is not executed.
+ */
+TinySqlApiResponseMsg *TinySqlApiSql::sqlExpired(TinySqlApiRequestMsg& msg)
+{
+    DPRINT << "SQLITEAPISRV:ERR, request" << msg.seq() << "of client" << msg.id() << "skipped, deadline passed";
     QSqlQuery query( mDb );
-    DPRINT << "SQLITEAPISRV:Executing SQL query..";
-    
-    // Note QSqlQuery::exec() executes synchronously, blocks the whole process
-    bool ret = query.exec( sqlQuery );
+    TinySqlApiResponseMsg *responsemsg = new TinySqlApiResponseMsg(0, msg.type(), query, msg.id(), msg.seq(), msg.itemKey() );
+    Q_CHECK_PTR(responsemsg);
+    responsemsg->setError(QSqlError::StatementError, TinySqlApiServerDefs::TinySqlApiDeadlineErrorText);
+    return responsemsg;
+}
+
+TinySqlApiResponseMsg *TinySqlApiSql::sqlExecuteQuery(TinySqlApiRequestMsg& msg)
+{
+    QString sqlQuery = msg.request();
+
+    // Statement is parsed only when it is not found from the cache
+    QSqlQuery *query = mStatements.take( sqlQuery );
+    bool prepared = (query != NULL);
+    if( !query ) {
+        query = new QSqlQuery( mDb );
+        Q_CHECK_PTR(query);
+        // Rows are read once, in order, while the result is sent. Without this
+        // the driver would cache every row read so far.
+        query->setForwardOnly(true);
+        prepared = query->prepare( sqlQuery );
+    }
+    DPRINT << "SQLITEAPISRV:Executing SQL query.. cached statements:" << mStatements.count();
+
+    bool ret = false;
+    int inserted = -1;
+    QString table = TinySqlApiRowCache::tableOf(sqlQuery);
+    if( prepared ) {
+        QVariantList params = msg.params();
+        if( msg.type() == WriteGenItemReq && msg.isCounted() ) {
+            // Row replacing another one is written by the statement itself
+            inserted = insertNew(table, sqlQuery, params);
+        }
+        if( inserted == 1 ) {
+            ret = true;
+        }
+        else {
+            for( int i=0; i<params.count(); i++ ) {
+                query->bindValue(i, params.at(i));
+            }
+            // Note QSqlQuery::exec() executes synchronously, blocks the executor thread
+            mInterruptible = isReadOnly(*query);
+            ret = query->exec();
+            mInterruptible = false;
+        }
+    }
     DPRINT << "SQLITEAPISRV:..done. Status:" << ret;
     // Instead of ret value, we check lastError()
     
-    if( query.lastError().number() > 0) {
-        DPRINT << "SQLITEAPISRV:SQL error validity :" << query.lastError().isValid();
-        DPRINT << "SQLITEAPISRV:SQL error text:" << query.lastError().text();
-        DPRINT << "SQLITEAPISRV:SQL error type:" << int(query.lastError().type());
+    if( query->lastError().number() > 0) {
+        DPRINT << "SQLITEAPISRV:SQL error validity :" << query->lastError().isValid();
+        DPRINT << "SQLITEAPISRV:SQL error text:" << query->lastError().text();
+        DPRINT << "SQLITEAPISRV:SQL error type:" << int(query->lastError().type());
+    }
+    TinySqlApiResponseMsg *responsemsg = new TinySqlApiResponseMsg(0, msg.type(), *query, msg.id(), msg.seq(), msg.itemKey() );
+    Q_CHECK_PTR(responsemsg);
+
+    if( ret ) {
+        switch( msg.type() ) {
+        case WriteGenItemReq:
+            responsemsg->setRowDelta(qMax(0, inserted), inserted >= 0);
+            break;
+        case DeleteReq:
+            responsemsg->setRowDelta(-query->numRowsAffected());
+            break;
+        case CreateTableReq:
+        case DeleteAllReq:
+            mTables.remove(table);
+            break;
+        default:
+            break;
+        }
+    }
+
+    if( !prepared ) {
+        delete query;
+    }
+    else if( responsemsg->isRowResult() ) {
+        // Response shares the statement while the rows are read, it is
+        // returned to the cache when the response is released
+        responsemsg->setStatement( sqlQuery );
+        delete query;
+    }
+    else {
+        mStatements.insert( sqlQuery, query );
+    }
+    return responsemsg;
+}
+
+/*
+ * Tells if the prepared statement does not write the database.
+ * Statement handle is read only when the driver uses the linked SQLite.
+ */
+bool TinySqlApiSql::isReadOnly(const QSqlQuery &query) const
+{
+    if( !mInterrupts || !query.result() ) {
+        return false;
+    }
+    QVariant handle = query.result()->handle();
+    if( handle.isValid() && qstrcmp(handle.typeName(), "sqlite3_stmt*") == 0 ) {
+        sqlite3_stmt *stmt = *static_cast<sqlite3_stmt * const *>(handle.constData());
+        return stmt && sqlite3_stmt_readonly(stmt);
+    }
+    return false;
+}
+
+bool TinySqlApiSql::transaction()
+{
+    if( !mDb.transaction() ) {
+        DPRINT << "SQLITEAPISRV:ERR, transaction not started:" << mDb.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool TinySqlApiSql::commit()
+{
+    return mDb.commit();
+}
+
+void TinySqlApiSql::rollback()
+{
+    if( !mDb.rollback() ) {
+        DPRINT << "SQLITEAPISRV:ERR, rollback failed:" << mDb.lastError().text();
     }
-    TinySqlApiResponseMsg *responsemsg = new TinySqlApiResponseMsg(this, msg.type(), query, msg.id(), msg.itemKey() );
+}
+
+/*
+ * Executes the statement once for every row of the parameters, each
+ * parameter is the list of values of one row. All the rows are written
+ * in one transaction, failing rows are skipped and reported by index.
+ * Inside the client transaction the rows are committed with it.
+ */
+TinySqlApiResponseMsg *TinySqlApiSql::sqlExecuteRows(TinySqlApiRequestMsg& msg, bool inTransaction)
+{
+    QString sqlQuery = msg.request();
+
+    QSqlQuery *query = mStatements.take( sqlQuery );
+    bool prepared = (query != NULL);
+    if( !query ) {
+        query = new QSqlQuery( mDb );
+        Q_CHECK_PTR(query);
+        query->setForwardOnly(true);
+        prepared = query->prepare( sqlQuery );
+    }
+
+    QVariantList rows = msg.params();
+    QList<int> failedRows;
+    QSqlError firstError;
+    DPRINT << "SQLITEAPISRV:Writing" << rows.count() << "row(s)..";
+
+    int rowDelta = 0;
+    bool rowDeltaExact = true;
+    if( prepared ) {
+        QString table = TinySqlApiRowCache::tableOf(sqlQuery);
+        bool ownTransaction = !inTransaction && transaction();
+        for( int row=0; row<rows.count(); row++ ) {
+            QVariantList values = rows.at(row).toList();
+            // Sees the earlier rows of the same request too
+            int inserted = msg.isCounted() ? insertNew(table, sqlQuery, values) : -1;
+            if( inserted == 1 ) {
+                rowDelta++;
+                continue;
+            }
+            for( int i=0; i<values.count(); i++ ) {
+                query->bindValue(i, values.at(i));
+            }
+            if( !query->exec() ) {
+                if( failedRows.isEmpty() ) {
+                    firstError = query->lastError();
+                }
+                failedRows.append(row);
+            }
+            else {
+                rowDeltaExact = rowDeltaExact && inserted == 0;
+            }
+        }
+        if( ownTransaction && !commit() ) {
+            // Nothing was written
+            firstError = mDb.lastError();
+            rollback();
+            rowDelta = 0;
+            rowDeltaExact = true;
+            failedRows.clear();
+            for( int row=0; row<rows.count(); row++ ) {
+                failedRows.append(row);
+            }
+        }
+    }
+    DPRINT << "SQLITEAPISRV:..done." << failedRows.count() << "row(s) failed";
+
+    TinySqlApiResponseMsg *responsemsg = new TinySqlApiResponseMsg(0, msg.type(), *query, msg.id(), msg.seq(), msg.itemKey() );
     Q_CHECK_PTR(responsemsg);
+
+    if( !prepared ) {
+        // Statement is invalid, error is from the prepare
+        for( int row=0; row<rows.count(); row++ ) {
+            failedRows.append(row);
+        }
+        delete query;
+    }
+    else {
+        if( firstError.isValid() ) {
+            responsemsg->setError(firstError.type(), firstError.text());
+        }
+        mStatements.insert( sqlQuery, query );
+    }
+    responsemsg->setRowsWritten(rows.count() - failedRows.count(), failedRows);
+    responsemsg->setRowDelta(rowDelta, rowDeltaExact);
     return responsemsg;
 }
+
+/*
+ * Inserts the row of the full-row insert of the client API only if it
+ * does not conflict with an existing row: 1 if it was inserted, 0 if it
+ * was not and -1 if it is not known. Changed row count of SQLite does not
+ * tell a replace from an insert, the insert is tried with OR IGNORE first.
+ * The caller then executes the statement itself, which replaces the
+ * conflicting row or fails with the error of the conflict.
+ */
+int TinySqlApiSql::insertNew(const QString &table, const QString &statement, const QVariantList &values)
+{
+    TableInfo tableInfo = describeTable(table);
+    if( !isFullRowInsert(statement, tableInfo) || values.count() != tableInfo.columns ) {
+        return -1;
+    }
+
+    // Same statement with the conflict clause, prepared once like the statement itself
+    QString sqlQuery = statement;
+    sqlQuery.replace(QRegExp("^\\s*INSERT\\s+INTO", Qt::CaseInsensitive), "INSERT OR IGNORE INTO");
+    QSqlQuery *query = mStatements.take( sqlQuery );
+    if( !query ) {
+        query = new QSqlQuery( mDb );
+        Q_CHECK_PTR(query);
+        query->setForwardOnly(true);
+        if( !query->prepare( sqlQuery ) ) {
+            delete query;
+            return -1;
+        }
+    }
+    for( int i=0; i<values.count(); i++ ) {
+        query->bindValue(i, values.at(i));
+    }
+    int inserted = -1;
+    if( query->exec() ) {
+        inserted = query->numRowsAffected() > 0 ? 1 : 0;
+    }
+    mStatements.insert( sqlQuery, query );
+    return inserted;
+}
+
+/*
+ * Counts the rows of the given tables, of all the tables if none are given.
+ * Names are read from the schema and quoted, the given lower case names
+ * only select among them. Tables not found are not in the result.
+ */
+QVariantMap TinySqlApiSql::countRows(const QStringList &tables)
+{
+    QVariantMap counts;
+    QSqlQuery names( mDb );
+    names.setForwardOnly(true);
+    if( !names.exec("SELECT name FROM sqlite_master WHERE type='table' AND name NOT LIKE 'sqlite\\_%' ESCAPE '\\'") ) {
+        DPRINT << "SQLITEAPISRV:ERR, tables not read, error:" << names.lastError().text();
+        return counts;
+    }
+    QStringList found;
+    while( names.next() ) {
+        QString name = names.value(0).toString();
+        if( tables.isEmpty() || tables.contains(name.toLower()) ) {
+            found.append(name);
+        }
+    }
+    names.finish();
+
+    foreach (const QString &name, found) {
+        QString quoted = name;
+        quoted.replace('"', "\"\"");
+        QSqlQuery count( mDb );
+        count.setForwardOnly(true);
+        if( count.exec(QString("SELECT COUNT(*) FROM \"%1\"").arg(quoted)) && count.next() ) {
+            counts.insert(name.toLower(), count.value(0).toInt());
+        }
+    }
+    return counts;
+}
+
+/*
+ * Insert of the client API, a value for every column in the column order.
+ */
+bool TinySqlApiSql::isFullRowInsert(const QString &statement, const TableInfo &tableInfo)
+{
+    QRegExp fullRow("\\s*INSERT\\s+INTO\\s+[^\\s(;]+\\s+VALUES\\s*\\(\\s*\\?(?:\\s*,\\s*\\?)*\\s*\\)\\s*;?\\s*",
+                    Qt::CaseInsensitive);
+    return tableInfo.columns > 0 && fullRow.exactMatch(statement) && statement.count('?') == tableInfo.columns;
+}
+
+/*
+ * Reads and deletes are keyed by the column of their WHERE term, the
+ * client may key them by any column. Full-row insert is keyed by its
+ * first value, which is the primary key only if it is the first column.
+ */
+QString TinySqlApiSql::keyColumn(const QString &table, const QString &statement)
+{
+    TableInfo tableInfo = describeTable(table);
+    QString primaryKey = tableInfo.primaryKey.toLower();
+    if( primaryKey.isEmpty() ) {
+        return QString();
+    }
+    if( isFullRowInsert(statement, tableInfo) ) {
+        return tableInfo.primaryKeyIndex == 0 ? primaryKey : QString();
+    }
+    return TinySqlApiRowCache::keyColumnOf(statement) == primaryKey ? primaryKey : QString();
+}
+
+/*
+ * Columns of the table from its schema, read once per table and
+ * read again after the table is created or deleted.
+ */
+TinySqlApiSql::TableInfo TinySqlApiSql::describeTable(const QString &table)
+{
+    QHash<QString, TableInfo>::const_iterator i = mTables.constFind(table);
+    if( i != mTables.constEnd() ) {
+        return i.value();
+    }
+    TableInfo tableInfo;
+    tableInfo.primaryKeyIndex = -1;
+    tableInfo.columns = 0;
+    bool composite = false;
+    QSqlQuery info( mDb );
+    if( info.exec(QString("PRAGMA table_info(%1)").arg(table)) ) {
+        // Columns: cid, name, type, notnull, dflt_value, pk
+        while( info.next() ) {
+            tableInfo.columns++;
+            if( info.value(5).toInt() == 1 ) {
+                tableInfo.primaryKey = info.value(1).toString();
+                tableInfo.primaryKeyIndex = info.value(0).toInt();
+            }
+            else if( info.value(5).toInt() > 1 ) {
+                composite = true;
+            }
+        }
+    }
+    if( composite ) {
+        tableInfo.primaryKey.clear();
+        tableInfo.primaryKeyIndex = -2;
+    }
+    mTables.insert(table, tableInfo);
+    return tableInfo;
+}
+
+QString TinySqlApiSql::primaryKey(const QString &table)
+{
+    return describeTable(table).primaryKey;
+}
+
+/*
+ * Returns the details of the query plan rows of the statement,
+ * values are bound as when it was executed.
+ */
+QStringList TinySqlApiSql::explain(const QString &statement, const QVariantList &params)
+{
+    QStringList plan;
+    QSqlQuery query( mDb );
+    query.setForwardOnly(true);
+    if( !query.prepare("EXPLAIN QUERY PLAN " + statement) ) {
+        DPRINT << "SQLITEAPISRV:ERR, statement not explained, error:" << query.lastError().text();
+        return plan;
+    }
+    for( int i=0; i<params.count(); i++ ) {
+        query.bindValue(i, params.at(i));
+    }
+    if( query.exec() ) {
+        // Columns: id, parent, notused, detail
+        while( query.next() ) {
+            plan.append(query.value(3).toString());
+        }
+    }
+    return plan;
+}
+
+/*
+ * Returns the statement of a released row result to the cache.
+ * Another copy may have been prepared meanwhile, then this one is dropped.
+ */
+void TinySqlApiSql::releaseStatement(TinySqlApiResponseMsg &msg)
+{
+    if( msg.statement().isEmpty() || mStatements.contains(msg.statement()) ) {
+        return;
+    }
+    QSqlQuery *query = new QSqlQuery( msg.query() );
+    Q_CHECK_PTR(query);
+    query->finish();
+    mStatements.insert( msg.statement(), query );
+}
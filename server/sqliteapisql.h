@@ -2,6 +2,11 @@
 #define _SQLITEAPISQL_H_
 
 #include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QCache>
+#include <QHash>
+#include <QAtomicInt>
+#include <QStringList>
 #include "sqliteapirequestmsg.h"
 
 class TinySqlApiResponseMsg;
@@ -15,14 +20,54 @@ class TinySqlApiSql : public QObject
 
 public:
     //! Constructs new TinySqlApiSql object  
-    explicit TinySqlApiSql(QObject *parent);
+    explicit TinySqlApiSql(QObject *parent, const QString &connectionName);
     
     //! Destructor    
     virtual ~TinySqlApiSql();
 
 public:
     bool initialize(const QString& name);
-    TinySqlApiResponseMsg *sqlExecute(TinySqlApiRequestMsg& msg);
+    // inTransaction: client transaction is open on this connection
+    TinySqlApiResponseMsg *sqlExecute(TinySqlApiRequestMsg& msg, bool inTransaction = false);
+    TinySqlApiResponseMsg *sqlExecuteRows(TinySqlApiRequestMsg& msg, bool inTransaction);
+    TinySqlApiResponseMsg *sqlExpired(TinySqlApiRequestMsg& msg);
+    TinySqlApiResponseMsg *sqlExecuteQuery(TinySqlApiRequestMsg& msg);
+    void releaseStatement(TinySqlApiResponseMsg &msg);
+    QStringList explain(const QString &statement, const QVariantList &params);
+    QVariantMap countRows(const QStringList &tables);
+
+    // Primary key column of the table, empty if none or several columns
+    QString primaryKey(const QString &table);
+
+    // Primary key column in lower case if the single-row statement is keyed by it,
+    // its value is then the first parameter. Empty for other statements.
+    QString keyColumn(const QString &table, const QString &statement);
+
+    bool transaction();
+    bool commit();
+    void rollback();
+    inline QString lastErrorText() const { return mDb.lastError().text(); }
+
+    // Interrupts the running statement, can be called from any thread
+    inline void abort() { mAbort = 1; }
+    inline void clearAbort() { mAbort = 0; }
+
+private:
+    // Primary key column, its index in the columns and the column count of a table.
+    // Index -1 if the table has no primary key, -2 if it has several columns.
+    struct TableInfo
+    {
+        QString primaryKey;
+        int primaryKeyIndex;
+        int columns;
+    };
+
+private:
+    static int progress(void *sql);
+    bool isReadOnly(const QSqlQuery &query) const;
+    int insertNew(const QString &table, const QString &statement, const QVariantList &values);
+    TableInfo describeTable(const QString &table);
+    static bool isFullRowInsert(const QString &statement, const TableInfo &tableInfo);
 
 private: // For testing    
 
@@ -31,6 +76,32 @@ private: // For testing
     #endif
 
     QSqlDatabase mDb;
+
+    // Every executor thread has its own named connection
+    QString mConnectionName;
+
+    // Prepared statements of this connection by SQL text, least recently used dropped first.
+    // Statement in use by an open result is not in the cache.
+    QCache<QString, QSqlQuery> mStatements;
+
+    // Columns of the tables by name
+    QHash<QString, TableInfo> mTables;
+
+    // Progress handler is installed, the driver uses the SQLite library the server is linked to.
+    // Otherwise running statements are not interrupted, see initialize().
+    bool mInterrupts;
+
+    // Statement being executed is read-only and may be interrupted.
+    // Interrupted write would roll back the whole open transaction.
+    bool mInterruptible;
+
+    // Checked by the SQLite progress handler while a statement runs
+    QAtomicInt mAbort;
+
+    // Deadline of the statement being executed, 0 for none.
+    // Used only in the executor thread.
+    qint64 mDeadline;
+    bool mDeadlineExceeded;
 };
 
 #endif // _SQLITEAPISTORAGE_H_
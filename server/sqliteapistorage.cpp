@@ -1,46 +1,302 @@
 // Includes
 #include "sqliteapistorage.h"
 #include "sqliteapisql.h"
+#include "sqliteapidatabase.h"
+#include "sqliteapirowcache.h"
+#include "sqliteapiindexadvisor.h"
+#include "sqliteapiserverdefs.h"
 #include "logging.h"
 
+#include <QTimer>
+#include <QDateTime>
+#include <QAtomicInt>
+
+// Result ids are unique over all the storages, 0 is no result
+static QAtomicInt nextResultId(1);
+
 TinySqlApiStorage::~TinySqlApiStorage()
 {
     DPRINT << "SQLITEAPISRV:~TinySqlApiStorage..";
 
-    disconnect(&mServer, SIGNAL(newRequest()), this, SLOT(handleRequest()));
-
-    delete mSqlHandler;
-    mSqlHandler = NULL;
+    // Closed in the executor thread already unless the thread never ran
+    close();
 }
 
-TinySqlApiStorage::TinySqlApiStorage(QObject *parent, TinySqlApiServer &server)
- : QObject(parent), mServer(server)
+TinySqlApiStorage::TinySqlApiStorage(QObject *parent, TinySqlApiServer &server, TinySqlApiDatabase &database,
+                                     const QString &connectionName, bool reader)
+ : QObject(parent), mServer(server), mDatabase(database), mConnectionName(connectionName), mReader(reader)
 {
-    mSqlHandler = new TinySqlApiSql(this);
+    mSqlHandler = new TinySqlApiSql(this, mConnectionName);
     Q_CHECK_PTR(mSqlHandler);
 
-    connect(&mServer, SIGNAL(newRequest()), this, SLOT(handleRequest()));
+    // Database is in the I/O thread, these are queued to the executor thread.
+    // All readers are signaled, the first free one takes the request.
+    if( mReader ) {
+        connect(&mDatabase, SIGNAL(newReadRequest()), this, SLOT(handleRequest()));
+    }
+    else {
+        connect(&mDatabase, SIGNAL(newRequest()), this, SLOT(handleRequest()));
+    }
+
+    // Child object, moves to the executor thread with the storage
+    mGroupTimer = new QTimer(this);
+    Q_CHECK_PTR(mGroupTimer);
+    mGroupTimer->setSingleShot(true);
+    mGroupTimer->setInterval(TinySqlApiServerDefs::TinySqlApiGroupCommitWindowMs);
+    mGroupMaxWrites = mReader ? 1 : TinySqlApiServerDefs::TinySqlApiGroupCommitMaxWrites;
+    mOpenResults = 0;
+    mInTransaction = false;
+    mRunningClient = -1;
+    mRunningSeq = -1;
+    connect(mGroupTimer, SIGNAL(timeout()), this, SLOT(commitGroup()));
 }
 
-bool TinySqlApiStorage::initialize(const QString& name)
+bool TinySqlApiStorage::initialize()
 {
-    DPRINT << "SQLITEAPISRV:TinySqlApiStorage, initializing DB:" << name;
-    return mSqlHandler->initialize(name);
+    DPRINT << "SQLITEAPISRV:TinySqlApiStorage, initializing DB:" << mDatabase.name();
+    return mSqlHandler->initialize(mDatabase.name());
+}
+
+/*
+ * Closes the connection in the executor thread, the database calls this
+ * before the thread quits. Open results are dropped.
+ */
+void TinySqlApiStorage::close()
+{
+    if( !mSqlHandler ) {
+        return;
+    }
+    if( mReader ) {
+        disconnect(&mDatabase, SIGNAL(newReadRequest()), this, SLOT(handleRequest()));
+    }
+    else {
+        disconnect(&mDatabase, SIGNAL(newRequest()), this, SLOT(handleRequest()));
+    }
+
+    // Writes held for the group commit are committed, but nobody receives the responses anymore
+    mGroupTimer->stop();
+    if( !mGroupResponses.isEmpty() ) {
+        mSqlHandler->commit();
+        mGroupResponses.clear();
+    }
+
+    // Queries are deleted before the database is closed
+    qDeleteAll(mResponses);
+    mResponses.clear();
+    mOpenResults = 0;
+
+    delete mSqlHandler;
+    mSqlHandler = NULL;
 }
 
 // 
 void TinySqlApiStorage::handleRequest()
 {  
     DPRINT << "SQLITEAPISRV:TinySqlApiStorage::handleRequest()";
-    TinySqlApiRequestMsg *request = mServer.getNextRequest();
-    Q_ASSERT(request);
+    TinySqlApiRequestMsg *request = mDatabase.getNextRequest(mReader);
+    if( !request ) {
+        // Another reader took the request or the queue was cleared
+        return;
+    }
+
+    ServerRequestType type = request->type();
+    bool grouped = (mGroupMaxWrites > 1 && !mInTransaction && type == WriteGenItemReq);
+    if( !grouped ) {
+        // Anything else sees and follows the writes of the open group
+        commitGroup();
+    }
+    else if( mGroupResponses.isEmpty() ) {
+        // First write of the group opens the transaction and the window
+        if( mSqlHandler->transaction() ) {
+            mGroupTimer->start();
+        }
+        else {
+            grouped = false;
+        }
+    }
 
-    // This method blocks the thread until finished
-    TinySqlApiResponseMsg *response = mSqlHandler->sqlExecute( *request );
+    // Row cache entry of the request, generation before the read sees the data.
+    // Only the single-row requests keyed by the primary key have the key column.
+    QString cacheTable = TinySqlApiRowCache::tableOf(request->request());
+    QString cacheColumn;
+    if( type == ReadGenItemReq || type == WriteGenItemReq || type == DeleteReq ) {
+        cacheColumn = mSqlHandler->keyColumn(cacheTable, request->request());
+    }
+    QVariant cacheKey = request->params().isEmpty() ? QVariant() : request->params().first();
+    quint64 cacheGeneration = mDatabase.rowCache().generation(cacheTable);
+
+    // Reads of the items are followed by the index advisor, not the requests of the server itself
+    bool advised = (type == ReadGenItemReq || type == ReadAllGenItemsReq || type == CountReq) && request->id() != 0;
+    QString statement = request->request();
+    QVariantList params = request->params();
+
+    // Cancel of an earlier request must not interrupt this one
+    mSqlHandler->clearAbort();
+    mRunningMutex.lock();
+    mRunningClient = request->id();
+    mRunningSeq = request->seq();
+    mRunningMutex.unlock();
+
+    // This method blocks the executor thread until finished
+    TinySqlApiResponseMsg *response = mSqlHandler->sqlExecute( *request, mInTransaction );
     delete request;
+
+    // Abort arriving after the statement finished must not hit the open results
+    mRunningMutex.lock();
+    mRunningClient = -1;
+    mRunningSeq = -1;
+    mSqlHandler->clearAbort();
+    mRunningMutex.unlock();
     
     Q_ASSERT(response);
     if( response ) {
+        if( type == BeginTransactionReq ) {
+            mInTransaction = (response->queryError() == QSqlError::NoError);
+        }
+        else if( type == CommitReq || type == RollbackReq ) {
+            if( response->queryError() != QSqlError::NoError ) {
+                // Transaction is not left open in the shared writer
+                mSqlHandler->rollback();
+            }
+            mInTransaction = false;
+        }
+
+        response->setStorage(this);
+        response->setResultId(nextResultId.fetchAndAddOrdered(1));
+        response->setCacheKey(cacheTable, cacheColumn, cacheKey, cacheGeneration);
+        mResponses.insert(response->resultId(), response);
+        mOpenResults = mResponses.count();
+        if( grouped ) {
+            mGroupResponses.append(response);
+            if( mGroupResponses.count() >= mGroupMaxWrites ) {
+                commitGroup();
+            }
+        }
+        else {
+            emit newResponse(response);
+        }
+    }
+
+    // Recurring statement is explained once, its response is already on the way
+    if( advised && mDatabase.indexAdvisor().sample(statement) ) {
+        mDatabase.indexAdvisor().setPlan(statement, mSqlHandler->explain(statement, params),
+                                         mSqlHandler->primaryKey(TinySqlApiRowCache::tableOf(statement)));
+    }
+}
+
+/*
+ * Interrupts the statement if it is still running the given request.
+ * The request is responded with the interrupted error.
+ */
+bool TinySqlApiStorage::abortRunning(int clientId, int seq)
+{
+    QMutexLocker locker(&mRunningMutex);
+    if( mRunningClient != clientId || mRunningSeq != seq ) {
+        return false;
+    }
+    mSqlHandler->abort();
+    return true;
+}
+
+/*
+ * Commits the writes of the group in one transaction and releases their
+ * responses. If the commit fails, the writes are rolled back and every
+ * write of the group responds with the error.
+ */
+void TinySqlApiStorage::commitGroup()
+{
+    mGroupTimer->stop();
+    if( mGroupResponses.isEmpty() ) {
+        return;
+    }
+    DPRINT << "SQLITEAPISRV:TinySqlApiStorage, committing" << mGroupResponses.count() << "write(s)";
+
+    if( !mSqlHandler->commit() ) {
+        QString error = mSqlHandler->lastErrorText();
+        DPRINT << "SQLITEAPISRV:ERR, group commit failed:" << error;
+        mSqlHandler->rollback();
+        foreach (TinySqlApiResponseMsg *response, mGroupResponses) {
+            if( response->queryError() == QSqlError::NoError ) {
+                response->setError(QSqlError::TransactionError, error);
+            }
+            response->setRowDelta(0);
+        }
+    }
+
+    QList<TinySqlApiResponseMsg *> responses = mGroupResponses;
+    mGroupResponses.clear();
+    foreach (TinySqlApiResponseMsg *response, responses) {
         emit newResponse(response);
     }
 }
+
+/*
+ * Sets the group commit limits, maxWrites 1 disables the group commit.
+ */
+void TinySqlApiStorage::setGroupCommit(int maxWrites, int windowMs)
+{
+    if( mReader ) {
+        return;
+    }
+    commitGroup();
+    mGroupMaxWrites = qMax(1, maxWrites);
+    mGroupTimer->setInterval(qMax(0, windowMs));
+}
+
+/*
+ * Counts the rows in the writer, between the requests. Writes responded
+ * before the counts are included in them, the later ones are not.
+ * No tables given counts all the tables of the database.
+ */
+void TinySqlApiStorage::countRows(const QStringList &tables)
+{
+    if( !mSqlHandler ) {
+        return;
+    }
+    // Held responses would arrive after the counts that include their writes
+    commitGroup();
+    emit rowsCounted(tables, mSqlHandler->countRows(tables));
+}
+
+/*
+ * Reads the next batch of rows of an open result. The result is deleted
+ * after its last batch, its id is never reused.
+ * Result whose deadline passed is ended with the timeout error instead,
+ * the rows already sent are not taken back.
+ */
+void TinySqlApiStorage::encodeBatch(int resultId, int type, int error)
+{
+    TinySqlApiResponseMsg *msg = mResponses.value(resultId);
+    if( !msg ) {
+        // Released or database changed meanwhile
+        DPRINT << "SQLITEAPISRV:encodeBatch: result already closed";
+        return;
+    }
+    int clientId = msg->id();
+    QByteArray block;
+    bool more = false;
+    if( msg->deadline() > 0 && QDateTime::currentMSecsSinceEpoch() >= msg->deadline() ) {
+        DPRINT << "SQLITEAPISRV:ERR, result of request" << msg->seq() << "of client" << clientId << "ended at the deadline";
+        mServer.encodeEndOfResult(msg->seq(), ServerResponseType(type), TimeoutError, block);
+    }
+    else {
+        more = mServer.encodeBatch(*msg, ServerResponseType(type), TinySqlApiServerError(error), block);
+    }
+    if( !more ) {
+        mResponses.remove(resultId);
+        mOpenResults = mResponses.count();
+        mSqlHandler->releaseStatement(*msg);
+        delete msg;
+    }
+    emit batchEncoded(clientId, resultId, block, more);
+}
+
+void TinySqlApiStorage::releaseResponse(int resultId)
+{
+    TinySqlApiResponseMsg *msg = mResponses.take(resultId);
+    if( msg ) {
+        mOpenResults = mResponses.count();
+        mSqlHandler->releaseStatement(*msg);
+        delete msg;
+    }
+}
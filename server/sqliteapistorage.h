@@ -2,12 +2,25 @@
 #define _SQLITEAPISTORAGE_H_
 
 #include <QObject>
+#include <QList>
+#include <QHash>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QStringList>
+#include <QVariant>
 #include "sqliteapiserver.h"
 
 class TinySqlApiSql;
+class TinySqlApiDatabase;
+class QTimer;
 
 /*
  * Generic Sqlite API storage handler.
+ * Lives in the SQL executor thread, the database connection and the
+ * queries are used only from that thread. Responses are passed to the
+ * server but stay owned by the storage until released.
+ * Each open database has one writer storage and reader storages,
+ * readers take the requests from the read queue only.
  */
 class TinySqlApiStorage : public QObject
 {
@@ -15,19 +28,39 @@ class TinySqlApiStorage : public QObject
 
 public:
     //! Constructs new TinySqlApiStorage
-    explicit TinySqlApiStorage(QObject *parent, TinySqlApiServer &server);
+    explicit TinySqlApiStorage(QObject *parent, TinySqlApiServer &server, TinySqlApiDatabase &database,
+                               const QString &connectionName, bool reader);
     
     //! Destructor    
     virtual ~TinySqlApiStorage();
 
-    bool initialize(const QString& name = "tinysqlapidb.db");
+public:
+    inline bool isReader() const { return mReader; }
+    inline TinySqlApiDatabase &database() const { return mDatabase; }
+
+    // Results not yet released, can be called from any thread
+    inline int openResults() const { return int(mOpenResults); }
+
+    // Interrupts the request if it is being executed, can be called from any thread
+    bool abortRunning(int clientId, int seq);
+
+public slots:
+    bool initialize();
+    void close();
+    void setGroupCommit(int maxWrites, int windowMs);
+    void countRows(const QStringList &tables);
     
 signals:
     void newResponse(TinySqlApiResponseMsg *msg);
+    void batchEncoded(int clientId, int resultId, const QByteArray &block, bool more);
+    void rowsCounted(const QStringList &tables, const QVariantMap &counts);
 
 private slots:
     // Signaled from server.
     void handleRequest();
+    void encodeBatch(int resultId, int type, int error);
+    void releaseResponse(int resultId);
+    void commitGroup();
 
 private: // For testing    
     #ifdef UNITTEST
@@ -36,6 +69,27 @@ private: // For testing
 
     TinySqlApiSql *mSqlHandler;
     TinySqlApiServer &mServer;
+    TinySqlApiDatabase &mDatabase;
+    QString mConnectionName;
+    bool mReader;
+
+    // Responses given to the server and not yet released, by result id
+    QHash<int, TinySqlApiResponseMsg *> mResponses;
+    QAtomicInt mOpenResults;
+
+    // Group commit (writer only): responses of the writes in the open
+    // transaction are held until the transaction is committed
+    QList<TinySqlApiResponseMsg *> mGroupResponses;
+    QTimer *mGroupTimer;
+    int mGroupMaxWrites;
+
+    // Client transaction is open (writer only), writes are not grouped meanwhile
+    bool mInTransaction;
+
+    // Client id and sequence number of the request being executed, -1 if none
+    mutable QMutex mRunningMutex;
+    int mRunningClient;
+    int mRunningSeq;
 };
 
 #endif // _SQLITEAPISTORAGE_H_
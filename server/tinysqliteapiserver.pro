@@ -10,11 +10,20 @@ CONFIG += qt \
 
 INCLUDEPATH += . ../inc
 
+# Progress handler of the connections is set through the SQLite C API.
+# It is installed only if the QSQLITE driver uses this same library.
+LIBS += -lsqlite3
+
 SOURCES += servermain.cpp \
     sqliteapiserver.cpp \
     sqliteapirequesthandler.cpp \
     sqliteapiresponsehandler.cpp \
     sqliteapirequestmsg.cpp \
+    sqliteapirequestconnection.cpp \
+    sqliteapirequestqueue.cpp \
+    sqliteapidatabase.cpp \
+    sqliteapirowcache.cpp \
+    sqliteapiindexadvisor.cpp \
     sqliteapisql.cpp \
     sqliteapistorage.cpp \
     sqliteapiresponsemsg.cpp
@@ -23,9 +32,16 @@ SOURCES += servermain.cpp \
 HEADERS += sqliteapiglobal.h \
     sqliteapidefs.h \
     sqliteapiserverdefs.h \
+    tinysqliteapiframe.h \
+    tinysqliterowcodec.h \
     sqliteapiserver.h \
     sqliteapirequesthandler.h \
     sqliteapirequestmsg.h \
+    sqliteapirequestconnection.h \
+    sqliteapirequestqueue.h \
+    sqliteapidatabase.h \
+    sqliteapirowcache.h \
+    sqliteapiindexadvisor.h \
     sqliteapiresponsehandler.h \
     sqliteapisql.h \
     sqliteapistorage.h \
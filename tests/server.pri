@@ -0,0 +1,28 @@
+# Server sources for the tests that need the server objects, without servermain.cpp
+LIBS += -lsqlite3
+
+SOURCES += ../../server/sqliteapiserver.cpp \
+    ../../server/sqliteapirequesthandler.cpp \
+    ../../server/sqliteapiresponsehandler.cpp \
+    ../../server/sqliteapirequestmsg.cpp \
+    ../../server/sqliteapirequestconnection.cpp \
+    ../../server/sqliteapirequestqueue.cpp \
+    ../../server/sqliteapidatabase.cpp \
+    ../../server/sqliteapirowcache.cpp \
+    ../../server/sqliteapiindexadvisor.cpp \
+    ../../server/sqliteapisql.cpp \
+    ../../server/sqliteapistorage.cpp \
+    ../../server/sqliteapiresponsemsg.cpp
+
+HEADERS += ../../server/sqliteapiserver.h \
+    ../../server/sqliteapirequesthandler.h \
+    ../../server/sqliteapirequestmsg.h \
+    ../../server/sqliteapirequestconnection.h \
+    ../../server/sqliteapirequestqueue.h \
+    ../../server/sqliteapidatabase.h \
+    ../../server/sqliteapirowcache.h \
+    ../../server/sqliteapiindexadvisor.h \
+    ../../server/sqliteapiresponsehandler.h \
+    ../../server/sqliteapisql.h \
+    ../../server/sqliteapistorage.h \
+    ../../server/sqliteapiresponsemsg.h
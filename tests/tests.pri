@@ -0,0 +1,15 @@
+# Common settings of the unit tests, private members are reached with
+# the UT_ friend classes of the headers
+QT += core \
+    network \
+    sql
+
+CONFIG += qt \
+    qtestlib \
+    console
+
+CONFIG -= app_bundle
+
+DEFINES += UNITTEST
+
+INCLUDEPATH += . ../../inc ../../server
@@ -0,0 +1,5 @@
+TEMPLATE = subdirs
+SUBDIRS  = ut_tinysqliterowcodec \
+    ut_tinysqlapirowcache \
+    ut_tinysqlapiresponsehandler \
+    ut_tinysqlapistorage
@@ -0,0 +1,138 @@
+// Includes
+#include <QtTest/QtTest>
+
+#include "sqliteapiserver.h"
+#include "sqliteapiresponsehandler.h"
+
+#include <string.h>
+
+/*
+ * Shared memory ring of the large response frames. Frames are written as
+ * sendFrame() writes them, the client socket is not needed.
+ */
+class UT_TinySqlApiResponseHandler : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void framesFollowEachOther();
+    void frameWrapsToTheBeginning();
+    void fullRingIsFreedByCredits();
+    void frameLargerThanRing();
+
+private:
+    bool send(int bytes, int &offset);
+
+    TinySqlApiServer *mServer;
+    TinySqlApiResponseHandler *mHandler;
+    int mRingSize;
+};
+
+static const int RingBytes = 8192;
+
+void UT_TinySqlApiResponseHandler::init()
+{
+    mServer = new TinySqlApiServer(0);
+    mServer->setRingBytes(RingBytes);
+    mHandler = new TinySqlApiResponseHandler(0, *mServer, 4321);
+    mRingSize = mHandler->mRingSize;
+    if( mRingSize == 0 ) {
+        QSKIP("Shared memory is not available", SkipSingle);
+    }
+    QCOMPARE(mRingSize, RingBytes);
+}
+
+void UT_TinySqlApiResponseHandler::cleanup()
+{
+    delete mHandler;
+    mHandler = NULL;
+    delete mServer;
+    mServer = NULL;
+}
+
+/*
+ * Writes the frame to the ring and keeps it unacknowledged until credited.
+ * Returns false if there is no room or the ring does not have the frame.
+ */
+bool UT_TinySqlApiResponseHandler::send(int bytes, int &offset)
+{
+    QByteArray frame(bytes, char('a' + mHandler->mUnackedFrames.count()));
+    TinySqlApiResponseHandler::SentFrame sent;
+    sent.bytes = bytes;
+    sent.ringBytes = 0;
+    if( !mHandler->writeToRing(frame, offset, sent.ringBytes) ) {
+        return false;
+    }
+    mHandler->mUnackedFrames.enqueue(sent);
+    mHandler->mUnackedBytes += bytes;
+    const char *ring = static_cast<const char *>(mHandler->mRing.constData());
+    return memcmp(ring + offset, frame.constData(), bytes) == 0;
+}
+
+void UT_TinySqlApiResponseHandler::framesFollowEachOther()
+{
+    int offset = -1;
+    QVERIFY(send(1000, offset));
+    QCOMPARE(offset, 0);
+    QVERIFY(send(2000, offset));
+    QCOMPARE(offset, 1000);
+    QCOMPARE(mHandler->mRingUsed, 3000);
+}
+
+void UT_TinySqlApiResponseHandler::frameWrapsToTheBeginning()
+{
+    const int frame = mRingSize * 3 / 8;
+    int offset = -1;
+    QVERIFY(send(frame, offset));
+    QVERIFY(send(frame, offset));
+    QCOMPARE(offset, frame);
+
+    // Third one fits only after the first is credited, the end of the ring is skipped
+    QVERIFY(!send(frame, offset));
+    mHandler->releaseCredits(1);
+    QVERIFY(send(frame, offset));
+    QCOMPARE(offset, 0);
+    QCOMPARE(mHandler->mRingUsed, mRingSize);
+
+    // Space of the second one is reused, the skipped end is freed with the third
+    QVERIFY(!send(1, offset));
+    mHandler->releaseCredits(1);
+    QVERIFY(send(frame, offset));
+    QCOMPARE(offset, frame);
+}
+
+void UT_TinySqlApiResponseHandler::fullRingIsFreedByCredits()
+{
+    const int frame = mRingSize / 4;
+    int offset = -1;
+    for( int i=0; i<4; i++ ) {
+        QVERIFY(send(frame, offset));
+    }
+    QVERIFY(!send(1, offset));
+    QCOMPARE(mHandler->unackedFrameCount(), 4);
+
+    // Credits release the oldest frames first
+    mHandler->releaseCredits(2);
+    QCOMPARE(mHandler->mRingUsed, 2 * frame);
+    QCOMPARE(mHandler->mUnackedBytes, qint64(2 * frame));
+
+    // Empty ring starts again from the beginning
+    mHandler->releaseCredits(2);
+    QCOMPARE(mHandler->mRingUsed, 0);
+    QCOMPARE(mHandler->mRingWritePos, 0);
+    QVERIFY(send(mRingSize, offset));
+    QCOMPARE(offset, 0);
+}
+
+// Such a frame goes through the socket
+void UT_TinySqlApiResponseHandler::frameLargerThanRing()
+{
+    int offset = -1;
+    QVERIFY(!send(mRingSize + 1, offset));
+    QCOMPARE(mHandler->mRingUsed, 0);
+}
+
+QTEST_MAIN(UT_TinySqlApiResponseHandler)
+#include "ut_tinysqlapiresponsehandler.moc"
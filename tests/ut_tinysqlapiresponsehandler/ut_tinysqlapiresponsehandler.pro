@@ -0,0 +1,8 @@
+TEMPLATE = app
+
+TARGET = ut_tinysqlapiresponsehandler
+
+include(../tests.pri)
+include(../server.pri)
+
+SOURCES += ut_tinysqlapiresponsehandler.cpp
@@ -0,0 +1,120 @@
+// Includes
+#include <QtTest/QtTest>
+
+#include "sqliteapirowcache.h"
+#include "tinysqliterowcodec.h"
+
+/*
+ * Keys and invalidation of the row cache of the primary key reads.
+ */
+class UT_TinySqlApiRowCache : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void keyColumnIsPartOfTheKey();
+    void invalidateRow();
+    void invalidateTable();
+    void fillOlderThanWriteIsDropped();
+    void namesOfTheStatement();
+
+private:
+    void insert(const QString &table, const QString &column, const QVariant &key);
+    bool contains(const QString &table, const QString &column, const QVariant &key);
+
+    TinySqlApiRowCache *mCache;
+};
+
+void UT_TinySqlApiRowCache::init()
+{
+    mCache = new TinySqlApiRowCache;
+    mCache->setMaxBytes(64 * 1024);
+}
+
+void UT_TinySqlApiRowCache::cleanup()
+{
+    delete mCache;
+    mCache = NULL;
+}
+
+void UT_TinySqlApiRowCache::insert(const QString &table, const QString &column, const QVariant &key)
+{
+    QByteArray schema(1, char(TinySqlApiRowCodec::TextColumn));
+    QByteArray data;
+    TinySqlApiRowCodec::appendRow(data, schema, QList<QVariant>() << key);
+    mCache->insert(table, column, key, mCache->generation(table), schema, 1, data);
+}
+
+bool UT_TinySqlApiRowCache::contains(const QString &table, const QString &column, const QVariant &key)
+{
+    QByteArray schema;
+    QByteArray data;
+    int rows = 0;
+    return mCache->find(table, column, key, schema, rows, data);
+}
+
+// Reads keyed by different columns do not get each other's rows
+void UT_TinySqlApiRowCache::keyColumnIsPartOfTheKey()
+{
+    insert("items", "id", 1);
+    QVERIFY(contains("items", "id", 1));
+    QVERIFY(contains("items", "id", QString("1")));
+    QVERIFY(!contains("items", "name", 1));
+    QVERIFY(!contains("other", "id", 1));
+    QCOMPARE(mCache->hits(), 2);
+    QCOMPARE(mCache->misses(), 2);
+}
+
+void UT_TinySqlApiRowCache::invalidateRow()
+{
+    insert("items", "id", 1);
+    insert("items", "id", 2);
+    mCache->invalidate("items", "id", 1);
+    QVERIFY(!contains("items", "id", 1));
+    QVERIFY(contains("items", "id", 2));
+}
+
+// Write not keyed by the primary key may change any row of the table
+void UT_TinySqlApiRowCache::invalidateTable()
+{
+    insert("items", "id", 1);
+    insert("items", "name", "a");
+    insert("items2", "id", 1);
+    mCache->invalidateTable("items");
+    QVERIFY(!contains("items", "id", 1));
+    QVERIFY(!contains("items", "name", "a"));
+    QVERIFY(contains("items2", "id", 1));
+}
+
+void UT_TinySqlApiRowCache::fillOlderThanWriteIsDropped()
+{
+    QByteArray schema(1, char(TinySqlApiRowCodec::TextColumn));
+    QByteArray data;
+    TinySqlApiRowCodec::appendRow(data, schema, QList<QVariant>() << 1);
+
+    quint64 generation = mCache->generation("items");
+    mCache->invalidate("items", "id", 2);
+    mCache->insert("items", "id", 1, generation, schema, 1, data);
+    QVERIFY(!contains("items", "id", 1));
+
+    generation = mCache->generation("items");
+    mCache->invalidateTable("other");
+    mCache->insert("items", "id", 1, generation, schema, 1, data);
+    QVERIFY(contains("items", "id", 1));
+}
+
+// SQLite compares the names case-insensitively
+void UT_TinySqlApiRowCache::namesOfTheStatement()
+{
+    QCOMPARE(TinySqlApiRowCache::tableOf("INSERT INTO Items VALUES (?, ?)"), QString("items"));
+    QCOMPARE(TinySqlApiRowCache::tableOf("select * from ITEMS where id = ?"), QString("items"));
+    QCOMPARE(TinySqlApiRowCache::keyColumnOf("SELECT * FROM items WHERE Name = ?"), QString("name"));
+    QCOMPARE(TinySqlApiRowCache::keyColumnOf("DELETE FROM items WHERE id = ?"), QString("id"));
+    QVERIFY(TinySqlApiRowCache::keyColumnOf("SELECT name FROM items WHERE id = ?").isEmpty());
+    QVERIFY(TinySqlApiRowCache::keyColumnOf("SELECT * FROM items WHERE id = ? AND name = ?").isEmpty());
+}
+
+QTEST_MAIN(UT_TinySqlApiRowCache)
+#include "ut_tinysqlapirowcache.moc"
@@ -0,0 +1,10 @@
+TEMPLATE = app
+
+TARGET = ut_tinysqlapirowcache
+
+include(../tests.pri)
+
+SOURCES += ut_tinysqlapirowcache.cpp \
+    ../../server/sqliteapirowcache.cpp
+
+HEADERS += ../../server/sqliteapirowcache.h
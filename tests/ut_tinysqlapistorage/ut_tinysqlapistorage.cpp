@@ -0,0 +1,216 @@
+// Includes
+#include <QtTest/QtTest>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+
+#include "sqliteapiserver.h"
+#include "sqliteapidatabase.h"
+#include "sqliteapistorage.h"
+#include "sqliteapirequestmsg.h"
+#include "sqliteapiresponsemsg.h"
+#include "sqliteapirowcache.h"
+#include "tinysqliterowcodec.h"
+
+/*
+ * Writer storage executing the requests in the test thread. The database
+ * only queues the requests, its own executors are never signaled.
+ */
+class UT_TinySqlApiStorage : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void groupCommit();
+    void groupCommitFailure();
+    void writeByPrimaryKeyDropsTheRow();
+    void writeNotByPrimaryKeyDropsTheTable();
+
+private:
+    void execute(ServerRequestType type, const QString &statement, const QVariantList &params);
+    bool exec(const QString &statement);
+    int count(const QString &table);
+    TinySqlApiResponseMsg *lastResponse() const;
+    void cacheRow(const QString &table, const QVariant &key);
+    bool isCached(const QString &table, const QVariant &key);
+
+    QString mFile;
+    TinySqlApiServer *mServer;
+    TinySqlApiDatabase *mDatabase;
+    TinySqlApiStorage *mStorage;
+    int mSeq;
+};
+
+static const char *WriterConnection = "ut_writer";
+
+void UT_TinySqlApiStorage::init()
+{
+    mFile = QDir::temp().filePath("ut_tinysqlapistorage.db");
+    QFile::remove(mFile);
+    QFile::remove(mFile + "-wal");
+    QFile::remove(mFile + "-shm");
+    mSeq = 0;
+
+    mServer = new TinySqlApiServer(0);
+    mDatabase = new TinySqlApiDatabase(0, *mServer, mFile, 900);
+    mStorage = new TinySqlApiStorage(0, *mServer, *mDatabase, WriterConnection, false);
+    QVERIFY(mStorage->initialize());
+
+    // Constraint of the child rows is checked only when the transaction commits
+    QVERIFY(exec("PRAGMA foreign_keys = ON"));
+    QVERIFY(exec("CREATE TABLE parent (id INTEGER PRIMARY KEY)"));
+    QVERIFY(exec("CREATE TABLE child (id INTEGER PRIMARY KEY, parent INTEGER "
+                 "REFERENCES parent(id) DEFERRABLE INITIALLY DEFERRED)"));
+    QVERIFY(exec("CREATE TABLE tagged (name TEXT, id INTEGER PRIMARY KEY)"));
+    QVERIFY(exec("INSERT INTO parent VALUES (1)"));
+}
+
+void UT_TinySqlApiStorage::cleanup()
+{
+    delete mStorage;
+    mStorage = NULL;
+    delete mDatabase;
+    mDatabase = NULL;
+    delete mServer;
+    mServer = NULL;
+    QFile::remove(mFile);
+    QFile::remove(mFile + "-wal");
+    QFile::remove(mFile + "-shm");
+}
+
+void UT_TinySqlApiStorage::execute(ServerRequestType type, const QString &statement, const QVariantList &params)
+{
+    mSeq++;
+    QVariant key = params.isEmpty() ? QVariant() : params.first();
+    mDatabase->mRequestQueue.enqueue(new TinySqlApiRequestMsg(0, 1, type, mSeq, key, statement, params));
+    mStorage->handleRequest();
+}
+
+bool UT_TinySqlApiStorage::exec(const QString &statement)
+{
+    QSqlQuery query(QSqlDatabase::database(WriterConnection));
+    return query.exec(statement);
+}
+
+int UT_TinySqlApiStorage::count(const QString &table)
+{
+    QSqlQuery query(QSqlDatabase::database(WriterConnection));
+    if( !query.exec(QString("SELECT COUNT(*) FROM %1").arg(table)) || !query.next() ) {
+        return -1;
+    }
+    return query.value(0).toInt();
+}
+
+TinySqlApiResponseMsg *UT_TinySqlApiStorage::lastResponse() const
+{
+    foreach (TinySqlApiResponseMsg *response, mStorage->mResponses) {
+        if( response->seq() == mSeq ) {
+            return response;
+        }
+    }
+    return NULL;
+}
+
+void UT_TinySqlApiStorage::cacheRow(const QString &table, const QVariant &key)
+{
+    TinySqlApiRowCache &cache = mDatabase->rowCache();
+    QByteArray schema(1, char(TinySqlApiRowCodec::IntegerColumn));
+    QByteArray data;
+    TinySqlApiRowCodec::appendRow(data, schema, QList<QVariant>() << key);
+    cache.insert(table, "id", key, cache.generation(table), schema, 1, data);
+}
+
+bool UT_TinySqlApiStorage::isCached(const QString &table, const QVariant &key)
+{
+    QByteArray schema;
+    QByteArray data;
+    int rows = 0;
+    return mDatabase->rowCache().find(table, "id", key, schema, rows, data);
+}
+
+// Responses are held until the writes are committed together
+void UT_TinySqlApiStorage::groupCommit()
+{
+    mStorage->setGroupCommit(3, 60000);
+    QSignalSpy responses(mStorage, SIGNAL(newResponse(TinySqlApiResponseMsg *)));
+
+    execute(WriteGenItemReq, "INSERT INTO child VALUES (?, ?)", QVariantList() << 1 << 1);
+    execute(WriteGenItemReq, "INSERT INTO child VALUES (?, ?)", QVariantList() << 2 << 1);
+    QCOMPARE(responses.count(), 0);
+    QCOMPARE(mStorage->mGroupResponses.count(), 2);
+
+    execute(WriteGenItemReq, "INSERT INTO child VALUES (?, ?)", QVariantList() << 3 << 1);
+    QCOMPARE(responses.count(), 3);
+    QVERIFY(mStorage->mGroupResponses.isEmpty());
+    foreach (TinySqlApiResponseMsg *response, mStorage->mResponses) {
+        QCOMPARE(response->queryError(), QSqlError::NoError);
+    }
+    QCOMPARE(count("child"), 3);
+}
+
+// Every write of the failed group responds with the error, none of them is kept
+void UT_TinySqlApiStorage::groupCommitFailure()
+{
+    mStorage->setGroupCommit(3, 60000);
+    QSignalSpy responses(mStorage, SIGNAL(newResponse(TinySqlApiResponseMsg *)));
+
+    execute(WriteGenItemReq, "INSERT INTO child VALUES (?, ?)", QVariantList() << 1 << 1);
+    execute(WriteGenItemReq, "INSERT INTO child VALUES (?, ?)", QVariantList() << 2 << 2);
+    QCOMPARE(responses.count(), 0);
+
+    mStorage->commitGroup();
+    QCOMPARE(responses.count(), 2);
+    QCOMPARE(mStorage->mResponses.count(), 2);
+    foreach (TinySqlApiResponseMsg *response, mStorage->mResponses) {
+        QCOMPARE(response->queryError(), QSqlError::TransactionError);
+        QCOMPARE(response->rowDelta(), 0);
+    }
+    QCOMPARE(count("child"), 0);
+
+    // Transaction is not left open, the next write is committed on its own
+    QVERIFY(exec("BEGIN"));
+    QVERIFY(exec("ROLLBACK"));
+    mStorage->setGroupCommit(1, 0);
+    execute(WriteGenItemReq, "INSERT INTO child VALUES (?, ?)", QVariantList() << 3 << 1);
+    QVERIFY(lastResponse());
+    QCOMPARE(lastResponse()->queryError(), QSqlError::NoError);
+    QCOMPARE(count("child"), 1);
+}
+
+void UT_TinySqlApiStorage::writeByPrimaryKeyDropsTheRow()
+{
+    mStorage->setGroupCommit(1, 0);
+    cacheRow("child", 1);
+    cacheRow("child", 2);
+
+    execute(WriteGenItemReq, "INSERT INTO child VALUES (?, ?)", QVariantList() << 1 << 1);
+    QVERIFY(lastResponse());
+    QCOMPARE(lastResponse()->cacheTable(), QString("child"));
+    QCOMPARE(lastResponse()->cacheColumn(), QString("id"));
+    mDatabase->invalidateCached(*lastResponse());
+
+    QVERIFY(!isCached("child", 1));
+    QVERIFY(isCached("child", 2));
+}
+
+// First value of the insert is not the primary key, any row may have changed
+void UT_TinySqlApiStorage::writeNotByPrimaryKeyDropsTheTable()
+{
+    mStorage->setGroupCommit(1, 0);
+    cacheRow("tagged", 1);
+    cacheRow("child", 1);
+
+    execute(WriteGenItemReq, "INSERT INTO Tagged VALUES (?, ?)", QVariantList() << "first" << 1);
+    QVERIFY(lastResponse());
+    QCOMPARE(lastResponse()->cacheTable(), QString("tagged"));
+    QVERIFY(lastResponse()->cacheColumn().isEmpty());
+    mDatabase->invalidateCached(*lastResponse());
+
+    QVERIFY(!isCached("tagged", 1));
+    QVERIFY(isCached("child", 1));
+}
+
+QTEST_MAIN(UT_TinySqlApiStorage)
+#include "ut_tinysqlapistorage.moc"
@@ -0,0 +1,8 @@
+TEMPLATE = app
+
+TARGET = ut_tinysqlapistorage
+
+include(../tests.pri)
+include(../server.pri)
+
+SOURCES += ut_tinysqlapistorage.cpp
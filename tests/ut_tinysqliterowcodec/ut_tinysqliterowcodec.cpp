@@ -0,0 +1,121 @@
+// Includes
+#include <QtTest/QtTest>
+
+#include "tinysqliterowcodec.h"
+
+/*
+ * Round trips of the rows through the binary row format of the result frames.
+ */
+class UT_TinySqlApiRowCodec : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void valuesKeepTheirTypes();
+    void valuesNotMatchingTheColumnType();
+    void severalRows();
+    void truncatedFrame();
+
+private:
+    QList<QVariant> roundTrip(const QByteArray &schema, const QList<QVariant> &row);
+};
+
+QList<QVariant> UT_TinySqlApiRowCodec::roundTrip(const QByteArray &schema, const QList<QVariant> &row)
+{
+    QByteArray frame;
+    TinySqlApiRowCodec::appendRow(frame, schema, row);
+
+    QList<QVariant> decoded;
+    int pos = 0;
+    bool read = TinySqlApiRowCodec::readRow(frame.constData(), frame.size(), pos, schema, decoded);
+    if( !read || pos != frame.size() ) {
+        return QList<QVariant>();
+    }
+    return decoded;
+}
+
+// Column without a declared type, like an expression or PRAGMA output
+void UT_TinySqlApiRowCodec::valuesKeepTheirTypes()
+{
+    QByteArray blob("\0\x01\xff\x80", 4);
+    QString text = QString::fromUtf8("\xc3\xa4\xe2\x82\xac \xe6\xbc\xa2");
+    QList<QVariant> row;
+    row << QVariant() << QVariant(Q_INT64_C(9007199254740993)) << QVariant(-2.5)
+        << QVariant(text) << QVariant(blob);
+    QByteArray schema(row.count(), char(TinySqlApiRowCodec::TextColumn));
+
+    QList<QVariant> decoded = roundTrip(schema, row);
+    QCOMPARE(decoded.count(), row.count());
+    QVERIFY(decoded.at(0).isNull());
+    QCOMPARE(decoded.at(1).type(), QVariant::LongLong);
+    QCOMPARE(decoded.at(1).toLongLong(), Q_INT64_C(9007199254740993));
+    QCOMPARE(decoded.at(2).type(), QVariant::Double);
+    QCOMPARE(decoded.at(2).toDouble(), -2.5);
+    QCOMPARE(decoded.at(3).type(), QVariant::String);
+    QCOMPARE(decoded.at(3).toString(), text);
+    QCOMPARE(decoded.at(4).type(), QVariant::ByteArray);
+    QCOMPARE(decoded.at(4).toByteArray(), blob);
+}
+
+// SQLite does not enforce the declared types
+void UT_TinySqlApiRowCodec::valuesNotMatchingTheColumnType()
+{
+    QList<QVariant> row;
+    row << QVariant(QString("abc")) << QVariant(42) << QVariant(QByteArray("\0a", 2));
+    QByteArray schema;
+    schema.append(char(TinySqlApiRowCodec::IntegerColumn));
+    schema.append(char(TinySqlApiRowCodec::RealColumn));
+    schema.append(char(TinySqlApiRowCodec::TextColumn));
+
+    QList<QVariant> decoded = roundTrip(schema, row);
+    QCOMPARE(decoded.count(), row.count());
+    QCOMPARE(decoded.at(0).type(), QVariant::String);
+    QCOMPARE(decoded.at(0).toString(), QString("abc"));
+    QCOMPARE(decoded.at(1).type(), QVariant::LongLong);
+    QCOMPARE(decoded.at(1).toInt(), 42);
+    QCOMPARE(decoded.at(2).type(), QVariant::ByteArray);
+    QCOMPARE(decoded.at(2).toByteArray(), QByteArray("\0a", 2));
+}
+
+void UT_TinySqlApiRowCodec::severalRows()
+{
+    QByteArray schema;
+    schema.append(char(TinySqlApiRowCodec::IntegerColumn));
+    schema.append(char(TinySqlApiRowCodec::TextColumn));
+    schema.append(char(TinySqlApiRowCodec::RealColumn));
+
+    QByteArray frame;
+    for( int i=0; i<10; i++ ) {
+        QList<QVariant> row;
+        row << QVariant(i) << (i % 2 ? QVariant() : QVariant(QString::number(i))) << QVariant(i / 4.0);
+        TinySqlApiRowCodec::appendRow(frame, schema, row);
+    }
+
+    int pos = 0;
+    for( int i=0; i<10; i++ ) {
+        QList<QVariant> row;
+        QVERIFY(TinySqlApiRowCodec::readRow(frame.constData(), frame.size(), pos, schema, row));
+        QCOMPARE(row.at(0).toInt(), i);
+        QCOMPARE(row.at(1).isNull(), i % 2 == 1);
+        QCOMPARE(row.at(2).toDouble(), i / 4.0);
+    }
+    QCOMPARE(pos, frame.size());
+}
+
+void UT_TinySqlApiRowCodec::truncatedFrame()
+{
+    QByteArray schema(2, char(TinySqlApiRowCodec::TextColumn));
+    QList<QVariant> row;
+    row << QVariant(QString("first")) << QVariant(QString("second"));
+    QByteArray frame;
+    TinySqlApiRowCodec::appendRow(frame, schema, row);
+
+    for( int size=0; size<frame.size(); size++ ) {
+        QList<QVariant> decoded;
+        int pos = 0;
+        QVERIFY(!TinySqlApiRowCodec::readRow(frame.constData(), size, pos, schema, decoded));
+    }
+}
+
+QTEST_MAIN(UT_TinySqlApiRowCodec)
+#include "ut_tinysqliterowcodec.moc"
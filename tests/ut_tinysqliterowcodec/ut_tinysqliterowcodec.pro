@@ -0,0 +1,9 @@
+TEMPLATE = app
+
+TARGET = ut_tinysqliterowcodec
+
+include(../tests.pri)
+
+SOURCES += ut_tinysqliterowcodec.cpp
+
+HEADERS += ../../inc/tinysqliterowcodec.h
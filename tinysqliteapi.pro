@@ -1,2 +1,2 @@
 TEMPLATE = subdirs
-SUBDIRS  = server/tinysqliteapiserver.pro client/tinysqliteapiclient.pro
+SUBDIRS  = server/tinysqliteapiserver.pro client/tinysqliteapiclient.pro tests/tests.pro